@@ -2,13 +2,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-// Include GLEW
-#include <GL/glew.h>
+// Include GLEW, through the call counter (see gl_call_counter.hpp)
+#include "../shared/gl_call_counter.hpp"
+
+// Binds and program switches, through the state cache (see gl_state_cache.hpp)
+#include "../shared/gl_state_cache.hpp"
 
 // Include GLFW
 #include <GLFW/glfw3.h>
 GLFWwindow* window;
 
+#include "../shared/headless.hpp"
+Headless headless;
+
 // Include GLM
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -33,10 +39,10 @@ glm::mat4 getViewMatrix() {
 void computeView() {
 
 	// glfwGetTime is called only once, the first time this function is called
-	static double lastTime = glfwGetTime();
+	static double lastTime = headless.Time();
 
 	// Compute time difference between current and last frame
-	double currentTime = glfwGetTime();
+	double currentTime = headless.Time();
 	float deltaTime = float(currentTime - lastTime);
 
 	// Compute new orientation
@@ -54,10 +60,15 @@ void computeView() {
 	lastTime = currentTime;
 }
 
-int main(void)
+int main(int argc, char* argv[])
 {
+	// --headless, --input, --report: see headless.hpp
+	for (int i = 1; i < argc; ++i) {
+		headless.ParseArg(argc, argv, i);
+	}
+
 	// Initialise GLFW
-	if (!glfwInit())
+	if (!headless.Init())
 	{
 		fprintf(stderr, "Failed to initialize GLFW\n");
 		getchar();
@@ -71,18 +82,16 @@ int main(void)
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 	// Open a window and create its OpenGL context
-	window = glfwCreateWindow(1024, 768, "HW 1-1", NULL, NULL);
+	window = headless.OpenWindow(1024, 768, "HW 1-1");
 	if (window == NULL) {
 		fprintf(stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n");
 		getchar();
 		glfwTerminate();
 		return -1;
 	}
-	glfwMakeContextCurrent(window);
 
 	// Initialize GLEW
-	glewExperimental = true; // Needed for core profile
-	if (glewInit() != GLEW_OK) {
+	if (!headless.InitGlew()) {
 		fprintf(stderr, "Failed to initialize GLEW\n");
 		getchar();
 		glfwTerminate();
@@ -104,9 +113,9 @@ int main(void)
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	GLuint VertexArrayID;
-	glGenVertexArrays(1, &VertexArrayID);
-	glBindVertexArray(VertexArrayID);
+	// One VAO per triangle
+	GLuint VertexArrayID[2];
+	glGenVertexArrays(2, VertexArrayID);
 
 	// Create and compile our GLSL program from the shaders
 	GLuint programRed = LoadShaders("VertexShader.vertexshader", "RedFragment.fragmentshader");
@@ -135,13 +144,31 @@ int main(void)
 
 	GLuint vertexbuffer[2];
 	glGenBuffers(2, &vertexbuffer[0]);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer[0]);
+	GLState().BindBuffer(GL_ARRAY_BUFFER, vertexbuffer[0]);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data_first), g_vertex_buffer_data_first, GL_STATIC_DRAW);
 
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer[1]);
+	GLState().BindBuffer(GL_ARRAY_BUFFER, vertexbuffer[1]);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data_second), g_vertex_buffer_data_second, GL_STATIC_DRAW);
 
+	// The attribute setup is recorded in each VAO once, so drawing is a bind and a draw
+	for (int i = 0; i < 2; i++) {
+		GLState().BindVertexArray(VertexArrayID[i]);
+
+		// 1rst attribute buffer : vertices
+		glEnableVertexAttribArray(0);
+		GLState().BindBuffer(GL_ARRAY_BUFFER, vertexbuffer[i]);
+		glVertexAttribPointer(
+			0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
+			3,                  // size
+			GL_FLOAT,           // type
+			GL_FALSE,           // normalized?
+			0,                  // stride
+			(void*)0            // array buffer offset
+		);
+	}
+
 	do {
+		headless.BeginFrame();
 
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -156,63 +183,40 @@ int main(void)
 
 		// --- First triangle
 		// Use our shader
-		glUseProgram(programRed);
+		GLState().UseProgram(programRed);
 
 		// Send our transformation to the currently bound shader, 
 		// in the "MVP" uniform
 		glUniformMatrix4fv(MatrixRed, 1, GL_FALSE, &MVP[0][0]);
 
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer[0]);
-		glVertexAttribPointer(
-			0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
 		// Draw the triangle !
+		GLState().BindVertexArray(VertexArrayID[0]);
 		glDrawArrays(GL_TRIANGLES, 0, 3);
 
 		// --- Second triangle
-		glUseProgram(programGreen);
+		GLState().UseProgram(programGreen);
 
 		glUniformMatrix4fv(MatrixGreen, 1, GL_FALSE, &MVP[0][0]);
 
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer[1]);
-		glVertexAttribPointer(
-			0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
+		GLState().BindVertexArray(VertexArrayID[1]);
 		glDrawArrays(GL_TRIANGLES, 0, 3);
 
-		glDisableVertexAttribArray(0);
-
 		// Swap buffers
-		glfwSwapBuffers(window);
+		headless.SwapBuffers();
 		glfwPollEvents();
 
 	} // Check if the ESC key was pressed or the window was closed
 	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
-		glfwWindowShouldClose(window) == 0);
+		!headless.ShouldClose());
 
 	// Cleanup VBO and shader
-	glDeleteBuffers(2, vertexbuffer);
-	glDeleteProgram(programRed);
-	glDeleteProgram(programGreen);
-	glDeleteVertexArrays(1, &VertexArrayID);
+	GLState().DeleteBuffers(2, vertexbuffer);
+	GLState().DeleteProgram(programRed);
+	GLState().DeleteProgram(programGreen);
+	GLState().DeleteVertexArrays(2, VertexArrayID);
 
 	// Close OpenGL window and terminate GLFW
-	glfwTerminate();
+	headless.Terminate();
 
 	return 0;
 }
@@ -2,13 +2,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-// Include GLEW
-#include <GL/glew.h>
+// Include GLEW, through the call counter (see gl_call_counter.hpp)
+#include "../shared/gl_call_counter.hpp"
+
+// Binds and program switches, through the state cache (see gl_state_cache.hpp)
+#include "../shared/gl_state_cache.hpp"
 
 // Include GLFW
 #include <GLFW/glfw3.h>
 GLFWwindow* window;
 
+#include "../shared/headless.hpp"
+Headless headless;
+
 // Include GLM
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -32,10 +38,10 @@ glm::mat4 getViewMatrix() {
 void computeView() {
 
 	// glfwGetTime is called only once, the first time this function is called
-	static double lastTime = glfwGetTime();
+	static double lastTime = headless.Time();
 
 	// Compute time difference between current and last frame
-	double currentTime = glfwGetTime();
+	double currentTime = headless.Time();
 	float deltaTime = float(currentTime - lastTime);
 
 	// Compute new orientation
@@ -53,10 +59,15 @@ void computeView() {
 	lastTime = currentTime;
 }
 
-int main(void)
+int main(int argc, char* argv[])
 {
+	// --headless, --input, --report: see headless.hpp
+	for (int i = 1; i < argc; ++i) {
+		headless.ParseArg(argc, argv, i);
+	}
+
 	// Initialise GLFW
-	if (!glfwInit())
+	if (!headless.Init())
 	{
 		fprintf(stderr, "Failed to initialize GLFW\n");
 		getchar();
@@ -70,18 +81,16 @@ int main(void)
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 	// Open a window and create its OpenGL context
-	window = glfwCreateWindow(1024, 768, "Tutorial 04 - Colored Cube", NULL, NULL);
+	window = headless.OpenWindow(1024, 768, "Tutorial 04 - Colored Cube");
 	if (window == NULL) {
 		fprintf(stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n");
 		getchar();
 		glfwTerminate();
 		return -1;
 	}
-	glfwMakeContextCurrent(window);
 
 	// Initialize GLEW
-	glewExperimental = true; // Needed for core profile
-	if (glewInit() != GLEW_OK) {
+	if (!headless.InitGlew()) {
 		fprintf(stderr, "Failed to initialize GLEW\n");
 		getchar();
 		glfwTerminate();
@@ -101,7 +110,7 @@ int main(void)
 
 	GLuint VertexArrayID;
 	glGenVertexArrays(1, &VertexArrayID);
-	glBindVertexArray(VertexArrayID);
+	GLState().BindVertexArray(VertexArrayID);
 
 	// Create and compile our GLSL program from the shaders
 	GLuint programID = LoadShaders("TransformVertexShader.vertexshader", "ColorFragmentShader.fragmentshader");
@@ -157,17 +166,45 @@ int main(void)
 		g_color_buffer_data[3 * v + 2] = 1.0f;
 	}
 
+	// Interleave position and color : six consecutive floats per vertex
+	static GLfloat g_interleaved_buffer_data[8 * 3 * 6];
+	for (int v = 0; v < 8 * 3; v++) {
+		for (int i = 0; i < 3; i++) {
+			g_interleaved_buffer_data[6 * v + i] = g_vertex_buffer_data[3 * v + i];
+			g_interleaved_buffer_data[6 * v + 3 + i] = g_color_buffer_data[3 * v + i];
+		}
+	}
+
 	GLuint vertexbuffer;
 	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
+	GLState().BindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(g_interleaved_buffer_data), g_interleaved_buffer_data, GL_STATIC_DRAW);
+
+	// The attribute setup is recorded in the VAO once, so drawing is a bind and a draw
+	// 1rst attribute buffer : vertices
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(
+		0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
+		3,                  // size
+		GL_FLOAT,           // type
+		GL_FALSE,           // normalized?
+		6 * sizeof(GLfloat), // stride
+		(void*)0            // array buffer offset
+	);
 
-	GLuint colorbuffer;
-	glGenBuffers(1, &colorbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(g_color_buffer_data), g_color_buffer_data, GL_STATIC_DRAW);
+	// 2nd attribute buffer : colors
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(
+		1,                                // attribute. No particular reason for 1, but must match the layout in the shader.
+		3,                                // size
+		GL_FLOAT,                         // type
+		GL_FALSE,                         // normalized?
+		6 * sizeof(GLfloat),              // stride
+		(void*)(3 * sizeof(GLfloat))      // array buffer offset
+	);
 
 	do {
+		headless.BeginFrame();
 
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -181,58 +218,31 @@ int main(void)
 
 
 		// Use our shader
-		glUseProgram(programID);
+		GLState().UseProgram(programID);
 
 		// Send our transformation to the currently bound shader, 
 		// in the "MVP" uniform
 		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
 
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : colors
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-		glVertexAttribPointer(
-			1,                                // attribute. No particular reason for 1, but must match the layout in the shader.
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
 		// Draw the triangle !
+		GLState().BindVertexArray(VertexArrayID);
 		glDrawArrays(GL_TRIANGLES, 0, 8 * 3); // 12*3 indices starting at 0 -> 12 triangles
 
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-
 		// Swap buffers
-		glfwSwapBuffers(window);
+		headless.SwapBuffers();
 		glfwPollEvents();
 
 	} // Check if the ESC key was pressed or the window was closed
 	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
-		glfwWindowShouldClose(window) == 0);
+		!headless.ShouldClose());
 
 	// Cleanup VBO and shader
-	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &colorbuffer);
-	glDeleteProgram(programID);
-	glDeleteVertexArrays(1, &VertexArrayID);
+	GLState().DeleteBuffers(1, &vertexbuffer);
+	GLState().DeleteProgram(programID);
+	GLState().DeleteVertexArrays(1, &VertexArrayID);
 
 	// Close OpenGL window and terminate GLFW
-	glfwTerminate();
+	headless.Terminate();
 
 	return 0;
 }
@@ -0,0 +1,127 @@
+#ifndef ASSET_LOADER_HPP
+#define ASSET_LOADER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Loads assets in the background. A job runs on a worker thread and does the
+// file I/O and parsing; it returns the upload, which needs the GL context and
+// so runs on the main thread the next time it calls Pump(), once a frame.
+// Until then the asset is a placeholder: a 1x1 texture, a mesh that draws
+// nothing.
+//
+// With no worker threads every job runs inside Load() and Finish() right
+// after the loads gives the old serial startup.
+class AssetLoader {
+public:
+	typedef std::function<void()> Upload;
+	typedef std::function<Upload()> Job;
+
+	AssetLoader() : pending(0), stopping(false) {}
+	~AssetLoader() { Stop(); }
+
+	void Start(int threads) {
+		for (int i = 0; i < threads; ++i) {
+			workers.emplace_back(&AssetLoader::Work, this);
+		}
+	}
+
+	// Joins the workers; jobs that have not started are dropped.
+	void Stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_ready.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+	}
+
+	// Main thread only.
+	void Load(Job job) {
+		++pending;
+		if (workers.empty()) {
+			Finished(job());
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(job);
+		}
+		work_ready.notify_one();
+	}
+
+	// Runs the uploads of the jobs that have finished, in the order they
+	// finished, and returns how many.
+	int Pump() {
+		std::vector<Upload> ready;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ready.swap(uploads);
+		}
+		for (Upload& upload : ready) {
+			if (upload) {
+				upload();
+			}
+		}
+		pending -= (int)ready.size();
+		return (int)ready.size();
+	}
+
+	// Waits for every job loaded so far and uploads it.
+	void Finish() {
+		while (pending > 0) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				upload_ready.wait(lock, [this] { return !uploads.empty(); });
+			}
+			Pump();
+		}
+	}
+
+	// Everything loaded so far is uploaded.
+	bool Idle() const { return pending == 0; }
+	int Threads() const { return (int)workers.size(); }
+
+private:
+	void Work() {
+		for (;;) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				work_ready.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping) {
+					return;
+				}
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			Finished(job());
+		}
+	}
+
+	void Finished(const Upload& upload) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			uploads.push_back(upload);
+		}
+		upload_ready.notify_one();
+	}
+
+	int pending; // loaded and not yet uploaded, main thread only
+	bool stopping;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable work_ready;
+	std::condition_variable upload_ready;
+	std::deque<Job> jobs;
+	std::vector<Upload> uploads;
+};
+
+#endif
@@ -0,0 +1,329 @@
+// CPU-only benchmarks for the hw2 simulation code.
+// No window or GL context is needed, only GLM:
+//     g++ -O2 -std=c++14 -pthread -I<path to glm> benchmark.cpp -o benchmark
+//     ./benchmark              runs everything
+//     ./benchmark collision    runs one group (collision, kernels, depth, jobs)
+//     ./benchmark jobs 8       scales the job system up to 8 threads (default: one per core)
+// Add -mavx to build the AVX kernels instead of SSE2.
+
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+using namespace glm;
+
+#include "collision_grid.hpp"
+#include "entities.hpp"
+#include "simulation.hpp"
+#include "simd_kernels.hpp"
+#include "frustum.hpp"
+#include "depth_order.hpp"
+#include "job_system.hpp"
+
+// Runs fn until at least min_seconds have passed and returns the mean time per call in ms.
+double TimeIt(const std::function<void()>& fn, double min_seconds = 0.25) {
+	typedef std::chrono::high_resolution_clock Clock;
+	int iterations = 0;
+	Clock::time_point start = Clock::now();
+	double elapsed = 0.0;
+	do {
+		fn();
+		++iterations;
+		elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	} while (elapsed < min_seconds);
+	return elapsed * 1000.0 / iterations;
+}
+
+// Same density as the game: ~100 objects on a 60x60 patch around the camera.
+void MakeScene(int count, ObjectStore& objects, FireballStore& fireballs) {
+	std::mt19937 rng(1234);
+	float half = 30.0f * std::sqrt(count / 200.0f);
+	std::uniform_real_distribution<float> xz(-half, half);
+	std::uniform_real_distribution<float> y(0.0f, 4.0f);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	objects = ObjectStore();
+	fireballs = FireballStore();
+	for (int i = 0; i < count / 2; ++i) {
+		objects.Add(vec3(xz(rng), 0.0f, xz(rng)), vec4(0.0f, 0.0f, 0.0f, 1.0f), 2.0f);
+	}
+	for (int i = 0; i < count - count / 2; ++i) {
+		vec3 dir = normalize(vec3(unit(rng), unit(rng), unit(rng)) + vec3(0.0f, 0.0f, 0.01f));
+		fireballs.Add(vec3(xz(rng), y(rng), xz(rng)), dir, 10.0f, 1.0f);
+	}
+}
+
+// The loop CheckCollision() used before the broadphase.
+void CollideBruteForce(ObjectStore& objects, FireballStore& fireballs) {
+	for (size_t f = 0; f < fireballs.Count(); ++f) {
+		for (size_t o = 0; o < objects.Count(); ++o) {
+			float dist = distance(objects.pos[o], fireballs.pos[f]);
+			if (dist <= objects.size[o] + fireballs.size[f] + 1) {
+				fireballs.explode[f] = 1;
+			}
+			if (dist <= objects.size[o] + fireballs.size[f]) {
+				fireballs.is_alive[f] = 0;
+				objects.is_alive[o] = 0;
+			}
+		}
+	}
+}
+
+int CountHits(const ObjectStore& objects, const FireballStore& fireballs) {
+	int hits = 0;
+	for (size_t i = 0; i < objects.Count(); ++i) {
+		hits += objects.is_alive[i] ? 0 : 1;
+	}
+	for (size_t i = 0; i < fireballs.Count(); ++i) {
+		hits += (fireballs.is_alive[i] ? 0 : 1) + (fireballs.explode[i] ? 1 : 0);
+	}
+	return hits;
+}
+
+void BenchCollision() {
+	printf("collision: fireballs vs objects, one tick\n");
+	printf("%10s %14s %14s %10s\n", "entities", "brute (ms)", "grid (ms)", "speedup");
+
+	const int counts[] = { 100, 10000, 100000 };
+	for (int count : counts) {
+		ObjectStore objects;
+		FireballStore fireballs;
+		MakeScene(count, objects, fireballs);
+
+		ObjectStore brute_objects = objects;
+		FireballStore brute_fireballs = fireballs;
+		// The brute-force loop is quadratic; one pass is plenty at 100k.
+		double brute_ms = TimeIt([&]() { CollideBruteForce(brute_objects, brute_fireballs); }, count >= 100000 ? 0.0 : 0.25);
+
+		CollisionGrid grid;
+		CollisionScratch scratch;
+		ObjectStore grid_objects = objects;
+		FireballStore grid_fireballs = fireballs;
+		double grid_ms = TimeIt([&]() { CollideFireballs(grid_objects, grid_fireballs, grid, scratch); });
+
+		if (CountHits(brute_objects, brute_fireballs) != CountHits(grid_objects, grid_fireballs)) {
+			printf("collision: grid and brute force disagree at %d entities\n", count);
+		}
+		printf("%10d %14.3f %14.3f %9.1fx\n", count, brute_ms, grid_ms, brute_ms / grid_ms);
+	}
+}
+
+void BenchKernels() {
+	printf("kernels: %s vs scalar\n", SimdPathName());
+	printf("%-28s %10s %14s %14s %10s\n", "kernel", "count", "scalar (us)", "simd (us)", "speedup");
+
+	const int count = 100000;
+	ObjectStore objects;
+	FireballStore fireballs;
+	MakeScene(2 * count, objects, fireballs);
+
+	// Fireball integration: the per-entity glm loop main used to run, the flat scalar loop, and Axpy.
+	float delta = 0.025f;
+	std::vector<vec3> pos = fireballs.pos;
+	std::vector<vec3> velocity = fireballs.velocity;
+	double glm_us = 1000.0 * TimeIt([&]() {
+		for (size_t i = 0; i < pos.size(); ++i) {
+			pos[i] += velocity[i] * delta;
+		}
+	});
+	double scalar_us = 1000.0 * TimeIt([&]() { AxpyScalar(&pos.data()->x, &velocity.data()->x, delta, 3 * pos.size()); });
+	double simd_us = 1000.0 * TimeIt([&]() { Axpy(&pos.data()->x, &velocity.data()->x, delta, 3 * pos.size()); });
+	printf("%-28s %10d %14.1f %14.1f %9.1fx\n", "integrate (glm loop)", count, glm_us, simd_us, glm_us / simd_us);
+	printf("%-28s %10d %14.1f %14.1f %9.1fx\n", "integrate (flat loop)", count, scalar_us, simd_us, scalar_us / simd_us);
+
+	// Sphere contacts of one fireball against every object, SoA.
+	std::vector<float> x(count), y(count), z(count);
+	for (int i = 0; i < count; ++i) {
+		x[i] = objects.pos[i].x;
+		y[i] = objects.pos[i].y;
+		z[i] = objects.pos[i].z;
+	}
+	std::vector<uint8_t> flags(count);
+	vec3 p = fireballs.pos[0];
+	volatile bool sink = false;
+	scalar_us = 1000.0 * TimeIt([&]() {
+		sink = SphereContactsScalar(x.data(), y.data(), z.data(), objects.size.data(), count, p.x, p.y, p.z, 1.0f, 1.0f, flags.data());
+	});
+	simd_us = 1000.0 * TimeIt([&]() {
+		sink = SphereContacts(x.data(), y.data(), z.data(), objects.size.data(), count, p.x, p.y, p.z, 1.0f, 1.0f, flags.data());
+	});
+	printf("%-28s %10d %14.1f %14.1f %9.1fx\n", "sphere contacts", count, scalar_us, simd_us, scalar_us / simd_us);
+
+	// Frustum culling of every object, from the middle of the scene; both must keep the same set.
+	vec3 eye = objects.pos[0];
+	mat4 vp = perspective(radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f) * lookAt(eye, eye + vec3(1, 0, 0), vec3(0, 1, 0));
+	FrustumPlanes planes = ExtractFrustumPlanes(vp);
+	std::vector<uint32_t> visible_scalar(count), visible_simd(count);
+	size_t n_scalar = 0, n_simd = 0;
+	scalar_us = 1000.0 * TimeIt([&]() {
+		n_scalar = CullSpheresScalar(&objects.pos.data()->x, objects.size.data(), 0.0f, count, planes, visible_scalar.data());
+	});
+	simd_us = 1000.0 * TimeIt([&]() {
+		n_simd = CullSpheres(&objects.pos.data()->x, objects.size.data(), 0.0f, count, planes, visible_simd.data());
+	});
+	bool same = n_scalar == n_simd && std::equal(visible_scalar.begin(), visible_scalar.begin() + n_scalar, visible_simd.begin());
+	printf("%-28s %10d %14.1f %14.1f %9.1fx  (%zu visible%s)\n", "frustum cull", count, scalar_us, simd_us, scalar_us / simd_us,
+		n_simd, same ? "" : ", MISMATCH");
+}
+
+// True if order is sorted nearest first along forward.
+bool IsFrontToBack(const DepthOrder& order, const std::vector<vec3>& pos, vec3 eye, vec3 forward) {
+	for (size_t k = 1; k < order.Count(); ++k) {
+		if (dot(pos[order.Order()[k - 1]] - eye, forward) > dot(pos[order.Order()[k]] - eye, forward) + 1e-3f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void BenchDepthOrder() {
+	printf("depth order: per-frame sort of every entity by view depth\n");
+	printf("%10s %14s %16s %10s %16s %10s\n", "entities", "std::sort (us)", "incremental (us)", "radix", "turnaround (us)", "speedup");
+
+	const int counts[] = { 10000, 100000, 1000000 };
+	for (int count : counts) {
+		ObjectStore objects;
+		FireballStore fireballs;
+		MakeScene(2 * count, objects, fireballs);
+		const std::vector<vec3>& pos = objects.pos;
+		const float* centers = &pos.data()->x;
+
+		// A camera walking through the scene and turning slowly, one step per frame.
+		int frame = 0;
+		vec3 eye, forward;
+		auto next_view = [&]() {
+			++frame;
+			float angle = 0.002f * frame;
+			eye = vec3(0.05f * frame, 1.0f, 0.0f);
+			forward = vec3(std::cos(angle), 0.0f, std::sin(angle));
+		};
+
+		// What SortObjects used to do on every spawn, with fresh distances.
+		std::vector<uint32_t> order(count);
+		std::vector<float> depth(count);
+		double sort_us = 1000.0 * TimeIt([&]() {
+			next_view();
+			for (int i = 0; i < count; ++i) {
+				order[i] = (uint32_t)i;
+				depth[i] = dot(pos[i] - eye, forward);
+			}
+			std::sort(order.begin(), order.end(), [&depth](uint32_t a, uint32_t b) { return depth[a] < depth[b]; });
+		});
+
+		DepthOrder incremental;
+		frame = 0;
+		next_view();
+		incremental.Update(centers, count, eye, forward);
+		unsigned long radix_before = incremental.RadixSorts();
+		int frame_before = frame;
+		double incremental_us = 1000.0 * TimeIt([&]() {
+			next_view();
+			incremental.Update(centers, count, eye, forward);
+		});
+		bool incremental_ok = IsFrontToBack(incremental, pos, eye, forward);
+		// Share of the incremental updates that still needed the radix sort.
+		double radix_share = 100.0 * (incremental.RadixSorts() - radix_before) / (frame - frame_before);
+
+		// The camera flips round every frame, so every update falls back to the radix sort.
+		DepthOrder turnaround;
+		double turnaround_us = 1000.0 * TimeIt([&]() {
+			forward = -forward;
+			turnaround.Update(centers, count, eye, forward);
+		});
+		bool turnaround_ok = IsFrontToBack(turnaround, pos, eye, forward);
+
+		printf("%10d %14.1f %16.1f %9.0f%% %16.1f %9.1fx%s\n", count, sort_us, incremental_us, radix_share, turnaround_us,
+			sort_us / incremental_us, incremental_ok && turnaround_ok ? "" : "  (NOT SORTED)");
+	}
+}
+
+// One simulation tick plus the frame's culling, as hw2 runs them on its job
+// system, from the same scene every time.
+void BenchJobs(int max_threads) {
+	const int count = 100000;
+	printf("jobs: move, collide, interpolate and cull %d entities, SimGrain %zu\n", count, SimGrain);
+	printf("%10s %14s %10s %12s %10s\n", "threads", "tick (ms)", "speedup", "efficiency", "steals");
+
+	ObjectStore scene_objects;
+	FireballStore scene_fireballs;
+	MakeScene(count, scene_objects, scene_fireballs);
+	vec3 eye = scene_objects.pos[0];
+	mat4 vp = perspective(radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f) * lookAt(eye, eye + vec3(1, 0, 0), vec3(0, 1, 0));
+	FrustumPlanes planes = ExtractFrustumPlanes(vp);
+
+	double serial_ms = 0.0;
+	int serial_hits = -1;
+	size_t serial_visible = 0;
+	for (int threads = 1; threads <= max_threads; threads = threads < max_threads ? std::min(threads * 2, max_threads) : threads + 1) {
+		JobSystem jobs;
+		jobs.Start(threads - 1);
+		ObjectStore objects;
+		FireballStore fireballs;
+		CollisionGrid grid;
+		CollisionScratch scratch;
+		std::vector<vec3> draw_pos(scene_fireballs.Count());
+		std::vector<float> draw_coeff(scene_fireballs.Count());
+		std::vector<uint32_t> visible(count);
+		size_t num_visible = 0;
+
+		// Each tick starts from the scene again; only the tick is timed.
+		const int ticks = 20;
+		double total_ms = 0.0;
+		for (int tick = 0; tick <= ticks; ++tick) {
+			objects = scene_objects;
+			fireballs = scene_fireballs;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			MoveFireballs(fireballs, 0.025f, &jobs);
+			CollideFireballs(objects, fireballs, grid, scratch, &jobs);
+			InterpolateFireballs(fireballs, 0.5f, draw_pos.data(), draw_coeff.data(), &jobs);
+			num_visible = CullSpheresParallel(&jobs, SimGrain, &objects.pos.data()->x, objects.size.data(), 0.0f, objects.Count(),
+				planes, visible.data());
+			num_visible += CullSpheresParallel(&jobs, SimGrain, &draw_pos.data()->x, fireballs.size.data(), 0.0f, fireballs.Count(),
+				planes, visible.data());
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			// The first tick warms the caches and the scratch up.
+			total_ms += tick > 0 ? ms : 0.0;
+		}
+		double tick_ms = total_ms / ticks;
+		int hits = CountHits(objects, fireballs);
+		if (threads == 1) {
+			serial_ms = tick_ms;
+			serial_hits = hits;
+			serial_visible = num_visible;
+		}
+		bool same = hits == serial_hits && num_visible == serial_visible;
+		printf("%10d %14.3f %9.2fx %11.0f%% %10lu%s\n", threads, tick_ms, serial_ms / tick_ms, 100.0 * serial_ms / tick_ms / threads,
+			jobs.Steals(), same ? "" : "  (MISMATCH)");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const char* group = argc > 1 ? argv[1] : "";
+	bool all = group[0] == '\0';
+
+	if (all || strcmp(group, "collision") == 0) {
+		BenchCollision();
+	}
+	if (all || strcmp(group, "kernels") == 0) {
+		BenchKernels();
+	}
+	if (all || strcmp(group, "depth") == 0) {
+		BenchDepthOrder();
+	}
+	if (all || strcmp(group, "jobs") == 0) {
+		int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+		BenchJobs(std::max(max_threads, 1));
+	}
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+#ifndef COLLISION_GRID_HPP
+#define COLLISION_GRID_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+// Uniform-grid broadphase over a set of spheres.
+// Cells are hashed into a power-of-two table and the entries are bucketed with a
+// counting sort, so a rebuild is O(n) and a query only walks the cells that
+// overlap the query box. Two cells may share a bucket; the caller always does
+// the exact distance test, so that only costs a few extra candidates.
+// The sphere data is copied into bucket order as separate x/y/z/radius arrays,
+// so a bucket is a contiguous range that the SIMD kernels can test directly.
+class CollisionGrid {
+public:
+	CollisionGrid() : cell_size(1.0f), inv_cell_size(1.0f), table_mask(0) {}
+
+	// cellSize should be close to the largest query radius: a query then
+	// touches at most 2x2x2 cells.
+	void Build(const glm::vec3* pos, const float* radius, size_t count, float cellSize) {
+		cell_size = cellSize;
+		inv_cell_size = 1.0f / cellSize;
+
+		uint32_t table_size = 64;
+		while (table_size < 2 * count) {
+			table_size <<= 1;
+		}
+		table_mask = table_size - 1;
+
+		cell_start.assign(table_size + 1, 0);
+		entity_bucket.resize(count);
+		entries.resize(count);
+		sorted_x.resize(count);
+		sorted_y.resize(count);
+		sorted_z.resize(count);
+		sorted_radius.resize(count);
+
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t bucket = Bucket(Cell(pos[i].x), Cell(pos[i].y), Cell(pos[i].z));
+			entity_bucket[i] = bucket;
+			++cell_start[bucket + 1];
+		}
+		for (uint32_t b = 0; b < table_size; ++b) {
+			cell_start[b + 1] += cell_start[b];
+		}
+		// cell_start[b] is used as a write cursor and ends up at the start of bucket b+1,
+		// so shift it back afterwards instead of keeping a second array.
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t slot = cell_start[entity_bucket[i]]++;
+			entries[slot] = (uint32_t)i;
+			sorted_x[slot] = pos[i].x;
+			sorted_y[slot] = pos[i].y;
+			sorted_z[slot] = pos[i].z;
+			sorted_radius[slot] = radius[i];
+		}
+		for (uint32_t b = table_size; b > 0; --b) {
+			cell_start[b] = cell_start[b - 1];
+		}
+		cell_start[0] = 0;
+	}
+
+	// Calls visit(begin, end) for every bucket whose cell overlaps the box
+	// [center - radius, center + radius]; [begin, end) indexes the sorted arrays.
+	// Each bucket is reported once as long as radius <= cellSize (the box then
+	// spans at most 3 cells per axis).
+	template <typename Visit>
+	void QueryRanges(const glm::vec3& center, float radius, Visit visit) const {
+		if (entries.empty()) {
+			return;
+		}
+		int x0 = Cell(center.x - radius), x1 = Cell(center.x + radius);
+		int y0 = Cell(center.y - radius), y1 = Cell(center.y + radius);
+		int z0 = Cell(center.z - radius), z1 = Cell(center.z + radius);
+
+		// Distinct cells can collide in the table; remember the buckets already walked.
+		const int MaxVisited = 27;
+		uint32_t visited[MaxVisited];
+		int num_visited = 0;
+
+		for (int x = x0; x <= x1; ++x) {
+			for (int y = y0; y <= y1; ++y) {
+				for (int z = z0; z <= z1; ++z) {
+					uint32_t bucket = Bucket(x, y, z);
+					bool seen = false;
+					for (int v = 0; v < num_visited; ++v) {
+						if (visited[v] == bucket) {
+							seen = true;
+							break;
+						}
+					}
+					if (seen) {
+						continue;
+					}
+					if (num_visited < MaxVisited) {
+						visited[num_visited++] = bucket;
+					}
+					if (cell_start[bucket] != cell_start[bucket + 1]) {
+						visit(cell_start[bucket], cell_start[bucket + 1]);
+					}
+				}
+			}
+		}
+	}
+
+	size_t Size() const { return entries.size(); }
+
+	// Index of the entity stored at a sorted slot.
+	uint32_t Entity(uint32_t slot) const { return entries[slot]; }
+
+	const float* X() const { return sorted_x.data(); }
+	const float* Y() const { return sorted_y.data(); }
+	const float* Z() const { return sorted_z.data(); }
+	const float* Radius() const { return sorted_radius.data(); }
+
+private:
+	int Cell(float v) const {
+		return (int)std::floor(v * inv_cell_size);
+	}
+
+	uint32_t Bucket(int x, int y, int z) const {
+		// Large primes from Teschner et al., "Optimized Spatial Hashing for Collision Detection".
+		uint32_t h = ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u) ^ ((uint32_t)z * 83492791u);
+		return h & table_mask;
+	}
+
+	float cell_size;
+	float inv_cell_size;
+	uint32_t table_mask;
+	std::vector<uint32_t> cell_start;
+	std::vector<uint32_t> entity_bucket;
+	std::vector<uint32_t> entries;
+	std::vector<float> sorted_x;
+	std::vector<float> sorted_y;
+	std::vector<float> sorted_z;
+	std::vector<float> sorted_radius;
+};
+
+#endif
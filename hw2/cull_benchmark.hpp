@@ -0,0 +1,165 @@
+#ifndef CULL_BENCHMARK_HPP
+#define CULL_BENCHMARK_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <random>
+#include <iostream>
+#include <functional>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../shared/gl_state_cache.hpp"
+#include "renderable.hpp"
+#include "stream_buffer.hpp"
+#include "frustum.hpp"
+#include "gpu_culling.hpp"
+#include "entities.hpp"
+#include "resident_column.hpp"
+
+// hw2 --benchmark-culling: draws 1k to 1M cubes scattered over a 400x400 patch
+// from a fixed camera, three ways, and prints the time per frame of each:
+//     all      upload every instance's index and draw them all (hw2 before culling)
+//     cpu      CullSpheres, upload the visible indices, draw those
+//     gpu      cull the resident positions with transform feedback, draw indirect
+// As in hw2, the transforms (and positions) sit in resident buffers, uploaded
+// once per size; the program fetches the transforms from transform_unit.
+// Every frame ends with glFinish, so the times include the GPU work.
+inline void BenchmarkCulling(const GLfloat* cube_vertices, GLsizei cube_vertex_count, GLuint program, GLint mvp_location,
+	GLint transform_unit, float radius) {
+	const int Sizes[] = { 1000, 10000, 100000, 1000000 };
+	const int MaxInstances = 1000000;
+	const GLsizei InstanceBytes = sizeof(uint32_t);
+
+	glm::mat4 view_projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f)
+		* glm::lookAt(glm::vec3(0.0f, 8.0f, -20.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	FrustumPlanes frustum = ExtractFrustumPlanes(view_projection);
+
+	StreamBuffer stream;
+	stream.Create((GLsizeiptr)MaxInstances * InstanceBytes + 4 * 16);
+	GpuCuller culler;
+	if (!culler.Create("Cull.vertexshader", "CullIndex.geometryshader", MaxInstances, GpuCuller::OutputIndex)) {
+		stream.Destroy();
+		return;
+	}
+	ResidentColumn resident_positions, resident_transforms;
+	resident_positions.Create(MaxInstances, sizeof(glm::vec3));
+	resident_transforms.Create(MaxInstances, sizeof(PackedTransform), GL_RGBA32F);
+	GLState().BindTextureUnit(transform_unit, GL_TEXTURE_BUFFER, resident_transforms.Texture());
+
+	Renderable mesh;
+	mesh.Create(cube_vertices, cube_vertex_count, 6 * sizeof(GLfloat));
+	mesh.VertexAttrib(0, 3, 0);
+	mesh.InstanceAttribI(1, 1, stream.Buffer());
+	mesh.VertexAttrib(2, 3, 3 * sizeof(GLfloat));
+
+	Renderable culled_mesh;
+	culled_mesh.CreateShared(mesh);
+	culled_mesh.VertexAttrib(0, 3, 0);
+	culled_mesh.InstanceAttribI(1, 1, culler.Output());
+	culled_mesh.VertexAttrib(2, 3, 3 * sizeof(GLfloat));
+	culler.SetDrawCount(culled_mesh.DrawCount());
+
+	std::cout << "culling benchmark: " << (culler.GpuDriven() ? "indirect count from a query buffer" : "count read back to the CPU") << "\n";
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> xz(-200.0f, 200.0f);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+	std::vector<glm::vec3> positions;
+	std::vector<PackedTransform> transforms;
+	std::vector<float> radii;
+	std::vector<uint32_t> all;
+	std::vector<uint32_t> visible;
+
+	for (int size : Sizes) {
+		positions.resize(size);
+		transforms.resize(size);
+		radii.assign(size, radius);
+		all.resize(size);
+		visible.resize(size);
+		for (int i = 0; i < size; ++i) {
+			positions[i] = glm::vec3(xz(rng), 0.0f, xz(rng));
+			float a = angle(rng);
+			transforms[i] = PackTransform(positions[i], glm::vec4(0.0f, sinf(a / 2), 0.0f, cosf(a / 2)));
+			all[i] = (uint32_t)i;
+		}
+		DirtyRanges everything;
+		everything.Mark(0, size);
+		resident_positions.Patch(positions.data(), size, everything);
+		resident_transforms.Patch(transforms.data(), size, everything);
+
+		size_t cpu_visible = 0;
+		GLuint gpu_visible = 0;
+		std::function<void()> paths[3] = {
+			[&]() {
+				GLintptr offsets[1];
+				stream.Begin();
+				memcpy(stream.Allocate(size * sizeof(uint32_t), &offsets[0]), all.data(), size * sizeof(uint32_t));
+				stream.End();
+				GLState().UseProgram(program);
+				glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &view_projection[0][0]);
+				mesh.DrawInstanced(size, offsets);
+				stream.Fence();
+			},
+			[&]() {
+				cpu_visible = CullSpheres(reinterpret_cast<const float*>(positions.data()), radii.data(), 0.0f, size, frustum, visible.data());
+				GLintptr offsets[1];
+				stream.Begin();
+				memcpy(stream.Allocate(cpu_visible * sizeof(uint32_t), &offsets[0]), visible.data(), cpu_visible * sizeof(uint32_t));
+				stream.End();
+				GLState().UseProgram(program);
+				glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &view_projection[0][0]);
+				mesh.DrawInstanced((GLsizei)cpu_visible, offsets);
+				stream.Fence();
+			},
+			[&]() {
+				culler.Cull(resident_positions.Buffer(), 0, 0, 0, size, frustum, radius, 0.0f);
+				GLState().UseProgram(program);
+				glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &view_projection[0][0]);
+				if (culler.GpuDriven()) {
+					culled_mesh.DrawIndirect(culler.IndirectBuffer());
+				}
+				else {
+					GLintptr offsets[] = { 0 };
+					culled_mesh.DrawInstanced(culler.VisibleCount(), offsets);
+				}
+			},
+		};
+
+		double ms[3];
+		for (int p = 0; p < 3; ++p) {
+			// At least three frames and a quarter of a second per path, after one warm-up frame.
+			paths[p]();
+			glFinish();
+			int frames = 0;
+			double start = glfwGetTime();
+			double elapsed = 0.0;
+			do {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				paths[p]();
+				glFinish();
+				++frames;
+				elapsed = glfwGetTime() - start;
+			} while (frames < 3 || elapsed < 0.25);
+			ms[p] = elapsed * 1000.0 / frames;
+		}
+		gpu_visible = culler.VisibleCount();
+
+		std::cout << size << " instances: all " << ms[0] << " ms, cpu " << ms[1] << " ms ("
+			<< cpu_visible << " visible), gpu " << ms[2] << " ms (" << gpu_visible << " visible)\n";
+	}
+
+	culled_mesh.Destroy();
+	mesh.Destroy();
+	culler.Destroy();
+	resident_transforms.Destroy();
+	resident_positions.Destroy();
+	stream.Destroy();
+}
+
+#endif
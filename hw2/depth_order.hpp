@@ -0,0 +1,161 @@
+#ifndef DEPTH_ORDER_HPP
+#define DEPTH_ORDER_HPP
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#include <glm/glm.hpp>
+
+// Draw order of a set of entities by view depth, kept from frame to frame.
+// Update() recomputes every depth along the view axis and re-sorts the order
+// from last frame's, which the camera and the entities have barely changed,
+// so an insertion sort finishes in close to one pass. When it has to move
+// entities too far (the camera turned around, or many spawned at once) it
+// stops and the order is rebuilt with a two-pass radix sort on 16-bit
+// quantised depth instead, which the insertion sort then finishes exactly.
+//
+// FrontToBack is for opaque passes (nearer fragments fill the depth buffer
+// first and early-Z rejects the rest), BackToFront for blended ones.
+//
+// Entities are identified by their index in the store. Swap-and-pop removal
+// moves the last entity into the removed slot, which just looks like that
+// entity jumped in depth; the next Update() puts it in place.
+class DepthOrder {
+public:
+	enum Direction { FrontToBack, BackToFront };
+
+	// The insertion sort gives up after this many moves per entity.
+	static const int MaxMovesPerEntity = 4;
+
+	explicit DepthOrder(Direction _direction = FrontToBack) : direction(_direction), radix_sorts(0) {}
+
+	// centers holds n xyz triples; forward need not be normalised.
+	void Update(const float* centers, size_t n, const glm::vec3& eye, const glm::vec3& forward) {
+		Resize(n);
+		glm::vec3 axis = direction == FrontToBack ? forward : -forward;
+		for (size_t k = 0; k < n; ++k) {
+			const float* c = centers + 3 * order[k];
+			key[k] = (c[0] - eye.x) * axis.x + (c[1] - eye.y) * axis.y + (c[2] - eye.z) * axis.z;
+		}
+		if (!InsertionSort(MaxMovesPerEntity * n + 64)) {
+			RadixSort();
+			InsertionSort(SIZE_MAX);
+			++radix_sorts;
+		}
+	}
+
+	// Entity indices in draw order.
+	const uint32_t* Order() const { return order.data(); }
+	size_t Count() const { return order.size(); }
+
+	// Rewrites visible[0, n), a set of entity indices such as CullSpheres
+	// writes, in draw order, and returns n.
+	size_t Sort(uint32_t* visible, size_t n) {
+		mask.assign(order.size(), 0);
+		for (size_t k = 0; k < n; ++k) {
+			mask[visible[k]] = 1;
+		}
+		// Written unconditionally, so stop once the last visible one is in:
+		// another write would land at visible[n].
+		size_t count = 0;
+		for (size_t k = 0; k < order.size() && count < n; ++k) {
+			uint32_t i = order[k];
+			visible[count] = i;
+			count += mask[i];
+		}
+		return count;
+	}
+
+	// How many updates fell back to the radix sort.
+	unsigned long RadixSorts() const { return radix_sorts; }
+
+private:
+	// Drops the indices that no longer exist and appends the new ones.
+	void Resize(size_t n) {
+		size_t kept = 0;
+		for (size_t k = 0; k < order.size(); ++k) {
+			order[kept] = order[k];
+			kept += order[k] < n;
+		}
+		order.resize(kept);
+		for (size_t i = kept; i < n; ++i) {
+			order.push_back((uint32_t)i);
+		}
+		key.resize(n);
+	}
+
+	// Ascending key; false if it ran out of moves (the order is then only
+	// partly sorted, but still a permutation).
+	bool InsertionSort(size_t max_moves) {
+		size_t moves = 0;
+		for (size_t k = 1; k < key.size(); ++k) {
+			float k_key = key[k];
+			if (key[k - 1] <= k_key) {
+				continue;
+			}
+			uint32_t k_index = order[k];
+			size_t j = k;
+			for (; j > 0 && key[j - 1] > k_key; --j) {
+				key[j] = key[j - 1];
+				order[j] = order[j - 1];
+			}
+			key[j] = k_key;
+			order[j] = k_index;
+			moves += k - j;
+			if (moves > max_moves) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// LSD radix sort on the key scaled to 16 bits over [min, max].
+	void RadixSort() {
+		size_t n = key.size();
+		float lo = key[0], hi = key[0];
+		for (float k : key) {
+			lo = k < lo ? k : lo;
+			hi = k > hi ? k : hi;
+		}
+		float scale = hi > lo ? 65535.0f / (hi - lo) : 0.0f;
+		quantised.resize(n);
+		for (size_t k = 0; k < n; ++k) {
+			quantised[k] = (uint16_t)((key[k] - lo) * scale);
+		}
+		scratch_key.resize(n);
+		scratch_order.resize(n);
+		scratch_quantised.resize(n);
+		for (int shift = 0; shift < 16; shift += 8) {
+			size_t start[257];
+			memset(start, 0, sizeof(start));
+			for (uint16_t q : quantised) {
+				++start[((q >> shift) & 0xff) + 1];
+			}
+			for (int b = 0; b < 256; ++b) {
+				start[b + 1] += start[b];
+			}
+			for (size_t k = 0; k < n; ++k) {
+				size_t to = start[(quantised[k] >> shift) & 0xff]++;
+				scratch_key[to] = key[k];
+				scratch_order[to] = order[k];
+				scratch_quantised[to] = quantised[k];
+			}
+			key.swap(scratch_key);
+			order.swap(scratch_order);
+			quantised.swap(scratch_quantised);
+		}
+	}
+
+	Direction direction;
+	std::vector<uint32_t> order;
+	std::vector<float> key; // key[k] is the depth of order[k]
+	std::vector<uint8_t> mask;
+	std::vector<uint16_t> quantised;
+	std::vector<float> scratch_key;
+	std::vector<uint32_t> scratch_order;
+	std::vector<uint16_t> scratch_quantised;
+	unsigned long radix_sorts;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef ENTITIES_HPP
+#define ENTITIES_HPP
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+// The vec3/vec4 columns below are handed to glBufferSubData as they are.
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "vec3 columns must be tightly packed");
+static_assert(sizeof(glm::vec4) == 4 * sizeof(float), "vec4 columns must be tightly packed");
+
+// An instance's rotation and position as three vec4 texels: column i of the
+// rotation in xyz, position component i in w. Object.vertexshader fetches
+// them from a buffer texture.
+struct PackedTransform {
+	glm::vec4 column[3];
+};
+static_assert(sizeof(PackedTransform) == 12 * sizeof(float), "PackedTransform columns must be tightly packed");
+
+// Rotation matrix of the unit quaternion q (xyz, w), column-major as the
+// shaders take it: rotation * v == q v q*.
+inline glm::mat3 QuatToRotation(const glm::vec4& q) {
+	float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+	glm::mat3 m;
+	m[0] = glm::vec3(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy));
+	m[1] = glm::vec3(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx));
+	m[2] = glm::vec3(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy));
+	return m;
+}
+
+inline PackedTransform PackTransform(const glm::vec3& pos, const glm::vec4& quat) {
+	glm::mat3 rotation = QuatToRotation(quat);
+	PackedTransform t;
+	for (int i = 0; i < 3; ++i) {
+		t.column[i] = glm::vec4(rotation[i], pos[i]);
+	}
+	return t;
+}
+
+// The slots [begin, end) of a store that were written since the last
+// Clear(), in the order it happened: appends, and the slots swap-removes
+// moved the last element into. A range that touches the last one extends it,
+// so a run of spawns is one range. Slots past the store's current count may
+// be listed; they hold nothing and are skipped by whoever reads the ranges.
+class DirtyRanges {
+public:
+	struct Range {
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	void Mark(size_t begin, size_t end) {
+		if (!ranges.empty() && begin <= ranges.back().end && end >= ranges.back().begin) {
+			ranges.back().begin = std::min(ranges.back().begin, (uint32_t)begin);
+			ranges.back().end = std::max(ranges.back().end, (uint32_t)end);
+			return;
+		}
+		Range range = { (uint32_t)begin, (uint32_t)end };
+		ranges.push_back(range);
+	}
+
+	void Clear() { ranges.clear(); }
+	bool Empty() const { return ranges.empty(); }
+	const std::vector<Range>& Ranges() const { return ranges; }
+
+private:
+	std::vector<Range> ranges;
+};
+
+// Swap-and-pop on one column: the last element moves into slot i.
+template <typename T>
+void SwapRemove(std::vector<T>& column, size_t i) {
+	column[i] = column.back();
+	column.pop_back();
+}
+
+// Enemies, one column per field. Live objects are packed at [0, Count()).
+// They never move, so the GPU keeps its own copy of pos/transform and only
+// the slots in changed are uploaded again.
+struct ObjectStore {
+	// Hot: read every tick.
+	std::vector<glm::vec3> pos;
+	std::vector<float> size;
+	// Read when a slot changes: pos and quat as one matrix, worked out in Add().
+	std::vector<PackedTransform> transform;
+	// Cold: set by collisions, read when compacting.
+	std::vector<uint8_t> is_alive;
+	// Slots written since the last frame snapshot took them.
+	DirtyRanges changed;
+
+	size_t Count() const { return pos.size(); }
+
+	void Add(const glm::vec3& _pos, const glm::vec4& _quat, float _size) {
+		changed.Mark(Count(), Count() + 1);
+		pos.push_back(_pos);
+		transform.push_back(PackTransform(_pos, _quat));
+		size.push_back(_size);
+		is_alive.push_back(1);
+	}
+
+	void Remove(size_t i) {
+		if (i + 1 < Count()) {
+			changed.Mark(i, i + 1);
+		}
+		SwapRemove(pos, i);
+		SwapRemove(transform, i);
+		SwapRemove(size, i);
+		SwapRemove(is_alive, i);
+	}
+
+	// dead(i) decides whether object i goes; swapped-in objects are re-tested.
+	template <typename Pred>
+	void RemoveIf(Pred dead) {
+		size_t i = 0;
+		while (i < Count()) {
+			if (dead(i)) {
+				Remove(i);
+			}
+			else {
+				++i;
+			}
+		}
+	}
+};
+
+// Projectiles. prev_pos/pos are the last two simulated positions, which the
+// fireball pass interpolates between; coeff stays 0 until the fireball starts
+// to explode.
+struct FireballStore {
+	// Hot: integrated, tested and uploaded every tick.
+	std::vector<glm::vec3> pos;
+	std::vector<glm::vec3> prev_pos;
+	std::vector<glm::vec3> velocity; // dir * speed
+	std::vector<float> size;
+	std::vector<float> coeff;
+	// Cold: set by collisions, read when compacting.
+	std::vector<uint8_t> is_alive;
+	std::vector<uint8_t> explode;
+
+	size_t Count() const { return pos.size(); }
+
+	void Add(const glm::vec3& _pos, const glm::vec3& dir, float speed, float _size) {
+		pos.push_back(_pos);
+		prev_pos.push_back(_pos);
+		velocity.push_back(dir * speed);
+		size.push_back(_size);
+		coeff.push_back(0.0f);
+		is_alive.push_back(1);
+		explode.push_back(0);
+	}
+
+	void Remove(size_t i) {
+		SwapRemove(pos, i);
+		SwapRemove(prev_pos, i);
+		SwapRemove(velocity, i);
+		SwapRemove(size, i);
+		SwapRemove(coeff, i);
+		SwapRemove(is_alive, i);
+		SwapRemove(explode, i);
+	}
+
+	template <typename Pred>
+	void RemoveIf(Pred dead) {
+		size_t i = 0;
+		while (i < Count()) {
+			if (dead(i)) {
+				Remove(i);
+			}
+			else {
+				++i;
+			}
+		}
+	}
+};
+
+#endif
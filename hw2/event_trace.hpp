@@ -0,0 +1,221 @@
+#ifndef EVENT_TRACE_HPP
+#define EVENT_TRACE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Everything that feeds the simulation from outside, keyed by simulation
+// step: spawned objects, shots, sim period changes and where the camera was.
+// Replaying a trace with the same seed gives the same entity timeline step
+// for step, whatever the frame rate, input or camera of the replaying run.
+//
+// File: "HW2T", u32 version, u64 seed, f64 step, f64 period, then records of
+// varint step delta, u8 type, payload (native floats). A 10-minute session
+// with constant camera movement is a few hundred KB.
+enum TraceEventType : uint8_t {
+	TraceEnd = 0,     // no payload; its step is the number of steps run
+	TraceCamera = 1,  // vec3 camera position, before the step runs
+	TracePeriod = 2,  // f64 sim period, before the step runs
+	TraceSpawn = 3,   // vec3 position, vec4 quat
+	TraceShot = 4,    // vec3 position, vec3 direction
+};
+
+struct TraceEvent {
+	uint64_t step;
+	TraceEventType type;
+	double period;
+	glm::vec3 pos;
+	glm::vec4 quat; // TraceShot: xyz is the direction
+};
+
+const uint32_t TraceVersion = 1;
+
+class TraceWriter {
+public:
+	TraceWriter() : file(NULL), last_step(0), has_camera(false) {}
+
+	bool Open(const char* path, uint64_t seed, double step, double period) {
+		file = fopen(path, "wb");
+		if (file == NULL) {
+			fprintf(stderr, "Impossible to write the trace %s\n", path);
+			return false;
+		}
+		fwrite("HW2T", 1, 4, file);
+		fwrite(&TraceVersion, sizeof(TraceVersion), 1, file);
+		fwrite(&seed, sizeof(seed), 1, file);
+		fwrite(&step, sizeof(step), 1, file);
+		fwrite(&period, sizeof(period), 1, file);
+		return true;
+	}
+
+	bool IsOpen() const { return file != NULL; }
+
+	// Only written when the camera has moved since the last one.
+	void Camera(uint64_t step, const glm::vec3& pos) {
+		if (file == NULL || (has_camera && pos == last_camera)) {
+			return;
+		}
+		has_camera = true;
+		last_camera = pos;
+		Begin(step, TraceCamera);
+		fwrite(&pos[0], sizeof(float), 3, file);
+	}
+
+	void Period(uint64_t step, double period) {
+		if (file == NULL) {
+			return;
+		}
+		Begin(step, TracePeriod);
+		fwrite(&period, sizeof(period), 1, file);
+	}
+
+	void Spawn(uint64_t step, const glm::vec3& pos, const glm::vec4& quat) {
+		if (file == NULL) {
+			return;
+		}
+		Begin(step, TraceSpawn);
+		fwrite(&pos[0], sizeof(float), 3, file);
+		fwrite(&quat[0], sizeof(float), 4, file);
+	}
+
+	void Shot(uint64_t step, const glm::vec3& pos, const glm::vec3& dir) {
+		if (file == NULL) {
+			return;
+		}
+		Begin(step, TraceShot);
+		fwrite(&pos[0], sizeof(float), 3, file);
+		fwrite(&dir[0], sizeof(float), 3, file);
+	}
+
+	void Close(uint64_t steps) {
+		if (file == NULL) {
+			return;
+		}
+		Begin(steps, TraceEnd);
+		fclose(file);
+		file = NULL;
+	}
+
+private:
+	void Begin(uint64_t step, TraceEventType type) {
+		uint64_t delta = step - last_step;
+		last_step = step;
+		do {
+			uint8_t byte = (uint8_t)(delta & 0x7f);
+			delta >>= 7;
+			fputc(byte | (delta != 0 ? 0x80 : 0), file);
+		} while (delta != 0);
+		fputc(type, file);
+	}
+
+	FILE* file;
+	uint64_t last_step;
+	bool has_camera;
+	glm::vec3 last_camera;
+};
+
+class TraceReader {
+public:
+	TraceReader() : seed(0), step(0.0), period(0.0), next(0), steps(0) {}
+
+	// Reads and decodes the whole trace.
+	bool Open(const char* path) {
+		FILE* file = fopen(path, "rb");
+		if (file == NULL) {
+			fprintf(stderr, "Impossible to open the trace %s\n", path);
+			return false;
+		}
+		std::vector<uint8_t> data;
+		uint8_t buffer[65536];
+		size_t read;
+		while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+			data.insert(data.end(), buffer, buffer + read);
+		}
+		fclose(file);
+
+		const size_t HeaderSize = 4 + sizeof(uint32_t) + sizeof(uint64_t) + 2 * sizeof(double);
+		uint32_t version = 0;
+		if (data.size() >= HeaderSize) {
+			memcpy(&version, &data[4], sizeof(version));
+		}
+		if (data.size() < HeaderSize || memcmp(&data[0], "HW2T", 4) != 0 || version != TraceVersion) {
+			fprintf(stderr, "%s is not a version %u trace\n", path, TraceVersion);
+			return false;
+		}
+		memcpy(&seed, &data[8], sizeof(seed));
+		memcpy(&step, &data[16], sizeof(step));
+		memcpy(&period, &data[24], sizeof(period));
+
+		size_t at = HeaderSize;
+		uint64_t current = 0;
+		while (at < data.size()) {
+			uint64_t delta = 0;
+			int shift = 0;
+			uint8_t byte;
+			do {
+				byte = data[at++];
+				delta |= (uint64_t)(byte & 0x7f) << shift;
+				shift += 7;
+			} while ((byte & 0x80) && at < data.size());
+			if (at >= data.size()) {
+				break;
+			}
+			current += delta;
+			TraceEvent event;
+			event.step = current;
+			event.type = (TraceEventType)data[at++];
+			size_t payload = event.type == TraceCamera ? 3 * sizeof(float)
+				: event.type == TracePeriod ? sizeof(double)
+				: event.type == TraceSpawn ? 7 * sizeof(float)
+				: event.type == TraceShot ? 6 * sizeof(float) : 0;
+			if (at + payload > data.size()) {
+				break;
+			}
+			if (event.type == TraceEnd) {
+				steps = current;
+				break;
+			}
+			if (event.type == TracePeriod) {
+				memcpy(&event.period, &data[at], sizeof(double));
+			}
+			else {
+				memcpy(&event.pos[0], data.data() + at, 3 * sizeof(float));
+				memcpy(&event.quat[0], data.data() + at + 3 * sizeof(float), payload - 3 * sizeof(float));
+			}
+			at += payload;
+			events.push_back(event);
+			steps = current + 1;
+		}
+		return true;
+	}
+
+	uint64_t Seed() const { return seed; }
+	double Step() const { return step; }
+	double Period() const { return period; }
+	// Steps the recorded run simulated.
+	uint64_t Steps() const { return steps; }
+	bool Finished(uint64_t step_count) const { return step_count >= steps; }
+
+	// The next event of step if it is one of the two types, else NULL. The
+	// camera and period events of a step come before its spawns and shots.
+	const TraceEvent* Next(uint64_t at_step, TraceEventType type_a, TraceEventType type_b) {
+		if (next < events.size() && events[next].step == at_step && (events[next].type == type_a || events[next].type == type_b)) {
+			return &events[next++];
+		}
+		return NULL;
+	}
+
+private:
+	uint64_t seed;
+	double step;
+	double period;
+	std::vector<TraceEvent> events;
+	size_t next;
+	uint64_t steps;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef FRAME_PIPELINE_HPP
+#define FRAME_PIPELINE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "entities.hpp"
+
+// Single-producer single-consumer ring of Capacity - 1 items. Push and Pop
+// never block or lock; each side only writes its own index.
+template <typename T, size_t Capacity>
+class SpscQueue {
+public:
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+	SpscQueue() : head(0), tail(0) {}
+
+	// Producer only; false when full.
+	bool Push(const T& item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == Capacity - 1) {
+			return false;
+		}
+		items[t & (Capacity - 1)] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only; false when empty.
+	bool Pop(T& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = items[h & (Capacity - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::atomic<size_t> head; // next to pop
+	char head_padding[64 - sizeof(size_t)];
+	std::atomic<size_t> tail; // next to push
+	char tail_padding[64 - sizeof(size_t)];
+	T items[Capacity];
+};
+
+// What the input stage hands the simulation stage. A Frame event closes each
+// frame's input: the steps due by time run when it is taken, from the
+// camera as it was sampled. sampled_ms is wall time, for measuring latency.
+struct InputEvent {
+	enum Type { Frame, Shot, Slower, Faster };
+	Type type;
+	uint64_t frame;
+	double time;
+	double sampled_ms;
+	glm::vec3 camera_pos;
+	glm::vec3 camera_dir;
+};
+
+// The part of the simulation state that a frame draws: the instance columns
+// (positions, transforms, coeffs and sizes) plus the interpolation alpha,
+// copied at the end of the frame's steps so the next steps can run while
+// this is drawn. Every snapshot is drawn once, in order, so object_changes
+// (the enemy slots written since the snapshot before) is what the GPU's copy
+// of the enemies needs patched.
+struct FrameSnapshot {
+	std::vector<glm::vec3> object_pos;
+	std::vector<PackedTransform> object_transform;
+	DirtyRanges object_changes;
+	std::vector<float> object_size;
+	std::vector<glm::vec3> fireball_prev_pos;
+	std::vector<glm::vec3> fireball_pos;
+	std::vector<float> fireball_coeff;
+	std::vector<float> fireball_size;
+	float alpha;
+	double period;          // wall seconds per step
+	uint64_t sim_steps;     // simulated so far
+	bool replay_finished;
+	std::vector<InputEvent> shots; // fired in these steps, not drawn before
+
+	FrameSnapshot() : alpha(0.0f), period(0.0), sim_steps(0), replay_finished(false) {}
+
+	size_t ObjectCount() const { return object_pos.size(); }
+	size_t FireballCount() const { return fireball_pos.size(); }
+
+	// Copies the drawn columns and takes the objects' changed slots; the
+	// vectors keep their capacity, so this stops allocating once the counts
+	// settle.
+	void Capture(ObjectStore& objects, const FireballStore& fireballs) {
+		object_pos.assign(objects.pos.begin(), objects.pos.end());
+		object_transform.assign(objects.transform.begin(), objects.transform.end());
+		object_changes = objects.changed;
+		objects.changed.Clear();
+		object_size.assign(objects.size.begin(), objects.size.end());
+		fireball_prev_pos.assign(fireballs.prev_pos.begin(), fireballs.prev_pos.end());
+		fireball_pos.assign(fireballs.pos.begin(), fireballs.pos.end());
+		fireball_coeff.assign(fireballs.coeff.begin(), fireballs.coeff.end());
+		fireball_size.assign(fireballs.size.begin(), fireballs.size.end());
+	}
+};
+
+// Two snapshots: the simulation stage fills Back() while the render stage
+// draws Front(). Only the render stage calls Publish(), once it knows the
+// back one is complete (it waited for the steps that fill it).
+class SnapshotBuffer {
+public:
+	SnapshotBuffer() : front(0) {}
+
+	const FrameSnapshot& Front() const { return buffers[front.load(std::memory_order_acquire)]; }
+	FrameSnapshot& Back() { return buffers[1 - front.load(std::memory_order_acquire)]; }
+	void Publish() { front.store(1 - front.load(std::memory_order_relaxed), std::memory_order_release); }
+
+private:
+	FrameSnapshot buffers[2];
+	std::atomic<int> front;
+};
+
+#endif
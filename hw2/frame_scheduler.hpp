@@ -0,0 +1,124 @@
+#ifndef FRAME_SCHEDULER_HPP
+#define FRAME_SCHEDULER_HPP
+
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "process_stats.hpp"
+
+// Shortest step period allowed; also bounds the steps one frame can run.
+const double MinStepPeriod = 1.0 / 120.0;
+
+// Fixed-step simulation clock, independent of how often frames are drawn.
+// Every period seconds of wall time the simulation advances by one step of
+// step seconds of game time; rendering interpolates between the last two
+// simulated states with Alpha(). A longer period makes the game run slower.
+class FixedTimestep {
+public:
+	// After a long stall (window drag, breakpoint) the backlog is dropped
+	// instead of simulating it all in one frame.
+	static const int MaxStepsPerFrame = 8;
+
+	FixedTimestep(double _step, double _period) : step(_step), period(std::max(_period, MinStepPeriod)), accumulator(0.0), last_time(-1.0) {}
+
+	double Step() const { return step; }
+	double Period() const { return period; }
+	void SetPeriod(double seconds) {
+		period = std::max(seconds, MinStepPeriod);
+		accumulator = std::min(accumulator, period);
+	}
+
+	// Adds the wall time since the previous call and returns how many steps are due.
+	int Advance(double now) {
+		if (last_time < 0.0) {
+			last_time = now;
+		}
+		accumulator += now - last_time;
+		last_time = now;
+
+		int steps = (int)(accumulator / period);
+		if (steps > MaxStepsPerFrame) {
+			steps = MaxStepsPerFrame;
+			accumulator = period * steps;
+		}
+		accumulator -= period * steps;
+		return steps;
+	}
+
+	// How far between the previous and the current simulation state to draw, in [0, 1).
+	float Alpha() const { return (float)(accumulator / period); }
+
+private:
+	double step;
+	double period;
+	double accumulator;
+	double last_time;
+};
+
+// Sleeps off whatever is left of min_period since frame_start. With vsync the
+// swap already blocks for the rest of the frame and this returns immediately.
+inline void PaceFrame(double frame_start, double now, double min_period) {
+	double remaining = min_period - (now - frame_start);
+	if (remaining > 0.0) {
+		std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+	}
+}
+
+// Frame time and CPU use over a reporting window.
+class FrameStats {
+public:
+	struct Report {
+		int frames;
+		double mean_ms;
+		double jitter_ms; // standard deviation of the frame time
+		double max_ms;
+		double cpu_percent; // of one core
+	};
+
+	FrameStats() : window_start(-1.0), cpu_start(0.0) { Reset(); }
+
+	void AddFrame(double frame_seconds) {
+		++frames;
+		sum += frame_seconds;
+		sum_sq += frame_seconds * frame_seconds;
+		max_frame = std::max(max_frame, frame_seconds);
+	}
+
+	// Returns the stats since the previous call and starts a new window.
+	Report Flush(double now) {
+		Report r;
+		r.frames = frames;
+		double mean = frames > 0 ? sum / frames : 0.0;
+		double variance = frames > 0 ? std::max(sum_sq / frames - mean * mean, 0.0) : 0.0;
+		r.mean_ms = mean * 1000.0;
+		r.jitter_ms = std::sqrt(variance) * 1000.0;
+		r.max_ms = max_frame * 1000.0;
+		double cpu = ProcessCpuSeconds();
+		double wall = now - window_start;
+		r.cpu_percent = window_start >= 0.0 && wall > 0.0 ? 100.0 * (cpu - cpu_start) / wall : 0.0;
+
+		window_start = now;
+		cpu_start = cpu;
+		Reset();
+		return r;
+	}
+
+private:
+	void Reset() {
+		frames = 0;
+		sum = 0.0;
+		sum_sq = 0.0;
+		max_frame = 0.0;
+	}
+
+	int frames;
+	double sum;
+	double sum_sq;
+	double max_frame;
+	double window_start;
+	double cpu_start;
+};
+
+#endif
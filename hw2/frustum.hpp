@@ -0,0 +1,136 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "job_system.hpp"
+#include "simd_kernels.hpp"
+
+// The six clip planes of a view-projection matrix, one array per component so
+// a sphere can be tested against all of them in one vector op. Planes 6 and 7
+// are padding that every sphere passes. Normals point inwards and are unit
+// length, so n.p + d is the signed distance of p from the plane.
+struct FrustumPlanes {
+	static const int Count = 6;
+	float nx[8];
+	float ny[8];
+	float nz[8];
+	float d[8];
+};
+
+// Gribb/Hartmann: each plane is the last row of the matrix plus or minus one of the others.
+inline FrustumPlanes ExtractFrustumPlanes(const glm::mat4& vp) {
+	FrustumPlanes planes;
+	for (int p = 0; p < 8; ++p) {
+		if (p >= FrustumPlanes::Count) {
+			planes.nx[p] = planes.ny[p] = planes.nz[p] = 0.0f;
+			planes.d[p] = 1e30f;
+			continue;
+		}
+		int row = p / 2;                  // left/right: x, bottom/top: y, near/far: z
+		float sign = p % 2 == 0 ? 1.0f : -1.0f;
+		float v[4];
+		for (int col = 0; col < 4; ++col) {
+			v[col] = vp[col][3] + sign * vp[col][row];
+		}
+		float len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		planes.nx[p] = v[0] / len;
+		planes.ny[p] = v[1] / len;
+		planes.nz[p] = v[2] / len;
+		planes.d[p] = v[3] / len;
+	}
+	return planes;
+}
+
+// Writes the index of every sphere that is at least partly inside the frustum
+// to visible, in ascending order, and returns how many there are. Sphere i is
+// centred at (centers[3i], centers[3i+1], centers[3i+2]) with radius
+// radius[i] + margin.
+inline size_t CullSpheresScalar(const float* centers, const float* radius, float margin, size_t n,
+	const FrustumPlanes& planes, uint32_t* visible) {
+	size_t count = 0;
+	for (size_t i = 0; i < n; ++i) {
+		const float* c = centers + 3 * i;
+		float r = radius[i] + margin;
+		bool inside = true;
+		for (int p = 0; p < FrustumPlanes::Count; ++p) {
+			inside = inside && planes.nx[p] * c[0] + planes.ny[p] * c[1] + planes.nz[p] * c[2] + planes.d[p] >= -r;
+		}
+		visible[count] = (uint32_t)i;
+		count += inside;
+	}
+	return count;
+}
+
+// Same, one sphere at a time against all planes at once.
+inline size_t CullSpheres(const float* centers, const float* radius, float margin, size_t n,
+	const FrustumPlanes& planes, uint32_t* visible) {
+#if defined(SIMD_KERNELS_AVX)
+	size_t count = 0;
+	__m256 nx = _mm256_loadu_ps(planes.nx), ny = _mm256_loadu_ps(planes.ny);
+	__m256 nz = _mm256_loadu_ps(planes.nz), d = _mm256_loadu_ps(planes.d);
+	for (size_t i = 0; i < n; ++i) {
+		const float* c = centers + 3 * i;
+		__m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, _mm256_set1_ps(c[0])), _mm256_mul_ps(ny, _mm256_set1_ps(c[1]))),
+			_mm256_add_ps(_mm256_mul_ps(nz, _mm256_set1_ps(c[2])), d));
+		int inside = _mm256_movemask_ps(_mm256_cmp_ps(dist, _mm256_set1_ps(-(radius[i] + margin)), _CMP_GE_OQ));
+		visible[count] = (uint32_t)i;
+		count += inside == 0xff;
+	}
+	return count;
+#elif defined(SIMD_KERNELS_SSE)
+	size_t count = 0;
+	__m128 nx0 = _mm_loadu_ps(planes.nx), ny0 = _mm_loadu_ps(planes.ny), nz0 = _mm_loadu_ps(planes.nz), d0 = _mm_loadu_ps(planes.d);
+	__m128 nx1 = _mm_loadu_ps(planes.nx + 4), ny1 = _mm_loadu_ps(planes.ny + 4), nz1 = _mm_loadu_ps(planes.nz + 4), d1 = _mm_loadu_ps(planes.d + 4);
+	for (size_t i = 0; i < n; ++i) {
+		const float* c = centers + 3 * i;
+		__m128 x = _mm_set1_ps(c[0]), y = _mm_set1_ps(c[1]), z = _mm_set1_ps(c[2]);
+		__m128 neg_r = _mm_set1_ps(-(radius[i] + margin));
+		__m128 dist0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx0, x), _mm_mul_ps(ny0, y)), _mm_add_ps(_mm_mul_ps(nz0, z), d0));
+		__m128 dist1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx1, x), _mm_mul_ps(ny1, y)), _mm_add_ps(_mm_mul_ps(nz1, z), d1));
+		int inside = _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(dist0, neg_r), _mm_cmpge_ps(dist1, neg_r)));
+		visible[count] = (uint32_t)i;
+		count += inside == 0xf;
+	}
+	return count;
+#else
+	return CullSpheresScalar(centers, radius, margin, n, planes, visible);
+#endif
+}
+
+// CullSpheres in chunks of grain spheres spread over jobs (or inline if it is
+// NULL), with the same result. Each chunk writes to its own slice of visible
+// and its count to its own slot; the slices are then packed together in order.
+inline size_t CullSpheresParallel(JobSystem* jobs, size_t grain, const float* centers, const float* radius, float margin, size_t n,
+	const FrustumPlanes& planes, uint32_t* visible) {
+	std::vector<size_t> chunk_counts(JobSystem::ChunkCount(n, grain));
+	ParallelFor(jobs, n, grain, [&](size_t begin, size_t end) {
+		size_t count = CullSpheres(centers + 3 * begin, radius + begin, margin, end - begin, planes, visible + begin);
+		for (size_t k = 0; k < count; ++k) {
+			visible[begin + k] += (uint32_t)begin;
+		}
+		chunk_counts[begin / grain] = count;
+	});
+	size_t total = 0;
+	for (size_t k = 0; k < chunk_counts.size(); ++k) {
+		memmove(visible + total, visible + k * grain, chunk_counts[k] * sizeof(uint32_t));
+		total += chunk_counts[k];
+	}
+	return total;
+}
+
+// out[k] = in[indices[k]], written once and in order, so out can be mapped memory.
+template <typename T>
+void GatherInstances(T* out, const T* in, const uint32_t* indices, size_t n) {
+	for (size_t k = 0; k < n; ++k) {
+		out[k] = in[indices[k]];
+	}
+}
+
+#endif
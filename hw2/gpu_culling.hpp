@@ -0,0 +1,214 @@
+#ifndef GPU_CULLING_HPP
+#define GPU_CULLING_HPP
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#include <GL/glew.h>
+
+#include "../shared/gl_state_cache.hpp"
+#include "frustum.hpp"
+
+// Matches DrawElementsIndirectCommand and DrawArraysIndirectCommand up to
+// instance_count, which is where the cull pass writes its count in both.
+struct IndirectDrawCommand {
+	GLuint count;
+	GLuint instance_count;
+	GLuint first;        // firstIndex / first
+	GLint base_vertex;   // baseVertex / baseInstance
+	GLuint base_instance;
+};
+
+inline GLuint CompileCullShader(GLenum type, const char* path) {
+	std::ifstream file(path);
+	if (!file.is_open()) {
+		fprintf(stderr, "Impossible to open %s.\n", path);
+		return 0;
+	}
+	std::stringstream source;
+	source << file.rdbuf();
+	std::string code = source.str();
+	const char* code_ptr = code.c_str();
+
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &code_ptr, NULL);
+	glCompileShader(shader);
+	GLint status = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE) {
+		GLint length = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+		std::vector<char> log(length + 1);
+		glGetShaderInfoLog(shader, length, NULL, &log[0]);
+		fprintf(stderr, "%s: %s\n", path, &log[0]);
+	}
+	return shader;
+}
+
+// Frustum culling on the GPU, GL 3.3 style: every instance goes through the
+// cull program as one point, the geometry shader only emits the ones inside
+// the frustum, and transform feedback packs those into Output(). The number
+// written is counted by a GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN query.
+//
+// With query buffer objects (GL 4.4, ARB_query_buffer_object) and indirect
+// draws the count is copied on the GPU into the instance_count of an indirect
+// command, so drawing the survivors never waits on the CPU. Without them
+// VisibleCount() reads the query back, which stalls until the pass is done.
+class GpuCuller {
+public:
+	// What the geometry shader writes for each instance it keeps: vec3
+	// outPosition then the vec4 outExtra it was given, or just its index as
+	// uint outIndex.
+	enum OutputFormat { OutputExtra, OutputIndex };
+	static const size_t OutputExtraOffset = 3 * sizeof(float);
+
+	GpuCuller() : program(0), vao(0), output(0), indirect(0), query(0), capacity(0), output_stride(0), gpu_driven(false) {}
+
+	bool Create(const char* vertex_path, const char* geometry_path, GLsizei max_instances, OutputFormat format = OutputExtra) {
+		capacity = max_instances;
+		output_stride = format == OutputIndex ? (GLsizei)sizeof(GLuint) : (GLsizei)(OutputExtraOffset + 4 * sizeof(float));
+		gpu_driven = (GLEW_VERSION_4_4 || GLEW_ARB_query_buffer_object) && (GLEW_VERSION_4_0 || GLEW_ARB_draw_indirect);
+
+		GLuint vertex_shader = CompileCullShader(GL_VERTEX_SHADER, vertex_path);
+		GLuint geometry_shader = CompileCullShader(GL_GEOMETRY_SHADER, geometry_path);
+		program = glCreateProgram();
+		glAttachShader(program, vertex_shader);
+		glAttachShader(program, geometry_shader);
+		const char* extra_varyings[] = { "outPosition", "outExtra" };
+		const char* index_varyings[] = { "outIndex" };
+		if (format == OutputIndex) {
+			glTransformFeedbackVaryings(program, 1, index_varyings, GL_INTERLEAVED_ATTRIBS);
+		}
+		else {
+			glTransformFeedbackVaryings(program, 2, extra_varyings, GL_INTERLEAVED_ATTRIBS);
+		}
+		glLinkProgram(program);
+		glDeleteShader(vertex_shader);
+		glDeleteShader(geometry_shader);
+		GLint status = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE) {
+			GLint length = 0;
+			glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+			std::vector<char> log(length + 1);
+			glGetProgramInfoLog(program, length, NULL, &log[0]);
+			fprintf(stderr, "cull program: %s\n", &log[0]);
+			return false;
+		}
+		planes_location = glGetUniformLocation(program, "planes");
+		radius_location = glGetUniformLocation(program, "radius");
+		radius_per_extra_location = glGetUniformLocation(program, "radiusPerExtra");
+
+		glGenVertexArrays(1, &vao);
+		GLState().BindVertexArray(vao);
+		glEnableVertexAttribArray(0);
+
+		glGenBuffers(1, &output);
+		GLState().BindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, output);
+		glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, (GLsizeiptr)capacity * output_stride, NULL, GL_DYNAMIC_COPY);
+
+		glGenBuffers(1, &indirect);
+		GLState().BindBuffer(GL_ARRAY_BUFFER, indirect);
+		IndirectDrawCommand command = { 0, 0, 0, 0, 0 };
+		glBufferData(GL_ARRAY_BUFFER, sizeof(command), &command, GL_DYNAMIC_DRAW);
+
+		glGenQueries(1, &query);
+		return true;
+	}
+
+	void Destroy() {
+		GLState().DeleteProgram(program);
+		GLState().DeleteVertexArrays(1, &vao);
+		GLState().DeleteBuffers(1, &output);
+		GLState().DeleteBuffers(1, &indirect);
+		glDeleteQueries(1, &query);
+	}
+
+	// Sets the per-instance vertex (or index) count of the indirect command.
+	void SetDrawCount(GLuint count) {
+		GLState().BindBuffer(GL_ARRAY_BUFFER, indirect);
+		glBufferSubData(GL_ARRAY_BUFFER, offsetof(IndirectDrawCommand, count), sizeof(GLuint), &count);
+	}
+
+	// Culls count instances whose positions (tightly packed vec3) start at
+	// position_offset in source and whose extra data (extra_size floats each)
+	// starts at extra_offset (extra_size 0: none, extra reads as 0). An
+	// instance is kept if its sphere of radius radius + radius_per_extra *
+	// extra.x touches the frustum.
+	void Cull(GLuint source, GLintptr position_offset, GLintptr extra_offset, GLint extra_size, GLsizei count,
+		const FrustumPlanes& frustum, float radius, float radius_per_extra) {
+		if (count > capacity) {
+			count = capacity;
+		}
+		GLState().UseProgram(program);
+		GLfloat planes[FrustumPlanes::Count * 4];
+		for (int p = 0; p < FrustumPlanes::Count; ++p) {
+			planes[p * 4 + 0] = frustum.nx[p];
+			planes[p * 4 + 1] = frustum.ny[p];
+			planes[p * 4 + 2] = frustum.nz[p];
+			planes[p * 4 + 3] = frustum.d[p];
+		}
+		glUniform4fv(planes_location, FrustumPlanes::Count, planes);
+		glUniform1f(radius_location, radius);
+		glUniform1f(radius_per_extra_location, radius_per_extra);
+
+		GLState().BindVertexArray(vao);
+		GLState().BindBuffer(GL_ARRAY_BUFFER, source);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)position_offset);
+		if (extra_size > 0) {
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, extra_size, GL_FLOAT, GL_FALSE, 0, (void*)extra_offset);
+		}
+		else {
+			glDisableVertexAttribArray(1);
+			glVertexAttrib4f(1, 0.0f, 0.0f, 0.0f, 0.0f);
+		}
+
+		glEnable(GL_RASTERIZER_DISCARD);
+		GLState().BindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, output);
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, query);
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, count);
+		glEndTransformFeedback();
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+		glDisable(GL_RASTERIZER_DISCARD);
+
+		if (gpu_driven) {
+			GLState().BindBuffer(GL_QUERY_BUFFER, indirect);
+			glGetQueryObjectuiv(query, GL_QUERY_RESULT, (GLuint*)offsetof(IndirectDrawCommand, instance_count));
+			GLState().BindBuffer(GL_QUERY_BUFFER, 0);
+		}
+	}
+
+	// Reads the last pass's count back to the CPU; waits for the GPU to finish it.
+	GLuint VisibleCount() const {
+		GLuint visible = 0;
+		glGetQueryObjectuiv(query, GL_QUERY_RESULT, &visible);
+		return visible;
+	}
+
+	// Bytes from one output instance to the next.
+	GLsizei OutputStride() const { return output_stride; }
+	bool GpuDriven() const { return gpu_driven; }
+	GLuint Output() const { return output; }
+	GLuint IndirectBuffer() const { return indirect; }
+
+private:
+	GLuint program;
+	GLint planes_location;
+	GLint radius_location;
+	GLint radius_per_extra_location;
+	GLuint vao;
+	GLuint output;
+	GLuint indirect;
+	GLuint query;
+	GLsizei capacity;
+	GLsizei output_stride;
+	bool gpu_driven;
+};
+
+#endif
@@ -2,152 +2,337 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
 #include <vector>
 #include <algorithm>
 #include <iostream>
 #include <string> 
+#include <string.h>
+#include <stddef.h>
+#include <chrono>
+#include <memory>
+#include <thread>
 
-// Include GLEW
-#include <GL/glew.h>
+// Include GLEW, through the call counter (see gl_call_counter.hpp)
+#include "../shared/gl_call_counter.hpp"
 
 // Include GLFW
 #include <GLFW/glfw3.h>
 GLFWwindow* window;
 
+#include "../shared/headless.hpp"
+Headless headless;
+
 // Include GLM
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
-#include <common/shader.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/texture.hpp>
-#include <common/text2D.hpp>
+
+#include "collision_grid.hpp"
+#include "entities.hpp"
+#include "simulation.hpp"
+#include "stream_buffer.hpp"
+#include "frame_scheduler.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_simplifier.hpp"
+#include "process_stats.hpp"
+#include "renderable.hpp"
+#include "frustum.hpp"
+#include "depth_order.hpp"
+#include "text_batch.hpp"
+#include "gpu_culling.hpp"
+#include "cull_benchmark.hpp"
+#include "transform_benchmark.hpp"
+#include "resident_column.hpp"
+#include "random.hpp"
+#include "event_trace.hpp"
+#include "asset_loader.hpp"
+#include "job_system.hpp"
+#include "frame_pipeline.hpp"
+#include "texture_cache.hpp"
+#include "shader_manager.hpp"
+#include "profiler.hpp"
 
 # define M_PI 3.14159265358979323846  /* pi */
 
+// Every random number of a run comes from here; --seed picks the sequence.
+Random Rng;
+
+// --record writes what happens to the simulation to a trace, --replay plays one
+// back instead of the input. SimSteps counts the steps simulated so far and
+// SimCamera and SimCameraDirection are where the camera was and looked for the
+// current one.
+TraceWriter Recorder;
+TraceReader Replay;
+bool Replaying = false;
+uint64_t SimSteps = 0;
+vec3 SimCamera;
+vec3 SimCameraDirection;
+
+// Startup times are measured from here, before main runs.
+const std::chrono::steady_clock::time_point ProgramStart = std::chrono::steady_clock::now();
+
+double MsSinceStart() {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - ProgramStart).count();
+}
+
 vec4 random_quaternion()
 {
-	// The rand() function is not very portable and may not be available on your system.
-	// Add the appropriate include or replace by an other random function in case of problem.
-	double seed = rand() / (double)RAND_MAX;
+	double seed = Rng.Uniform01();
 	double r1 = std::sqrt(1.0 - seed);
 	double r2 = std::sqrt(seed);
-	double t1 = 2.0 * M_PI * (rand() / (double)RAND_MAX);
-	double t2 = 2.0 * M_PI * (rand() / (double)RAND_MAX);
+	double t1 = 2.0 * M_PI * Rng.Uniform01();
+	double t2 = 2.0 * M_PI * Rng.Uniform01();
 	return vec4(std::sin(t1) * r1, std::cos(t1) * r1, std::sin(t2) * r2, std::cos(t2) * r2);
 }
 
-struct Object {
-	vec3 pos;
-	float size;
-	vec4 quat;
-	float cameradistance;
-	bool is_alive;
-
-	bool operator<(const Object& that) const {
-		return this->cameradistance > that.cameradistance;
-	}
-
-	Object(vec3 _pos, vec4 _quat) : pos(_pos), quat(_quat) {
-		size = 2.0f;
-		is_alive = true;
-		vec3 cam_pos = getCameraPosition();
-		cameradistance = distance(pos, cam_pos);
-	}
-};
-
+const float ObjectSize = 2.0f;
 const int MaxObjects = 100;
 const int MaxDistance = 30;
 const int MinDistance = -30;
-std::vector<Object> ObjectsContainer;
+ObjectStore ObjectsContainer;
+
+void AddObject(const vec3& pos, const vec4& quat) {
+	ObjectsContainer.Add(pos, quat, ObjectSize);
+}
 
 void InstantiateObject() {
-	float x_p = rand() % (MaxDistance - MinDistance + 1) + MinDistance;
-	float y_p = rand() % MaxDistance;
-	float z_p = rand() % (MaxDistance - MinDistance + 1) + MinDistance;
+	float x_p = Rng.UniformInt(MinDistance, MaxDistance);
+	float y_p = Rng.UniformInt(0, MaxDistance - 1);
+	float z_p = Rng.UniformInt(MinDistance, MaxDistance);
 
 	vec3 pos(x_p, 0, z_p);
-	pos += getCameraPosition();
+	pos += SimCamera;
 	vec4 quat = random_quaternion();
-	ObjectsContainer.emplace_back(Object(pos, quat));
+	Recorder.Spawn(SimSteps, pos, quat);
+	AddObject(pos, quat);
 }
 
 
-void SortObjects() {
-	std::sort(ObjectsContainer.begin(), ObjectsContainer.end());
-}
+const float FireballSpeed = 10.0f;
+const float FireballSize = 1.0f;
+const int MaxFireballs = 100;
+FireballStore FireballsContainer;
+// sphere.obj and up to four coarser versions of it, each half the triangles.
+const int FireballLodLevels = 5;
+// A fireball is drawn with the coarsest level whose error is under this many pixels.
+const float LodPixelError = 1.0f;
 
-struct Fireball {
-	vec3 pos;
-	vec3 dir;
-	float speed;
-	float size;
-	bool is_alive;
-	bool explode;
-	float coeff;
-
-	Fireball(vec3 _pos, vec3 _dir) : pos(_pos), dir(_dir) {
-		is_alive = true;
-		explode = false;
-		speed = 10.0f;
-		size = 1.0f;
-		coeff = 0.0f;
-	}
-};
+const int WindowWidth = 1024;
+const int WindowHeight = 768;
 
-const int MaxFireballs = 100;
-std::vector<Fireball> FireballsContainer;
+void AddFireball(const vec3& pos, const vec3& dir) {
+	FireballsContainer.Add(pos, dir, FireballSpeed, FireballSize);
+}
 
 void InstantiateFireball() {
-	vec3 dir = normalize(getCameraDirection());
-	vec3 pos = getCameraPosition() + dir;
-	FireballsContainer.emplace_back(Fireball(pos, dir));
+	if (FireballsContainer.Count() >= MaxFireballs) {
+		return;
+	}
+	vec3 dir = normalize(SimCameraDirection);
+	vec3 pos = SimCamera + dir;
+	Recorder.Shot(SimSteps, pos, dir);
+	AddFireball(pos, dir);
 }
 
 void RemoveFarFireballs() {
-	for (int i = FireballsContainer.size() - 1; i >= 0; --i) {
-		vec3 camera_pos = getCameraPosition();
-		vec3 fireball_pos = FireballsContainer[i].pos;
-		float dist = distance(fireball_pos, camera_pos);
-		if (dist >= MaxDistance + 10) {
-			FireballsContainer.erase(FireballsContainer.begin() + i);
+	PROFILE_SCOPE("remove far");
+	vec3 camera_pos = SimCamera;
+	const std::vector<vec3>& pos = FireballsContainer.pos;
+	FireballsContainer.RemoveIf([&pos, camera_pos](size_t i) {
+		return distance(pos[i], camera_pos) >= MaxDistance + 10;
+	});
+}
+
+// Maps a DDS and reads it into the page cache on a loader thread, then hands
+// it to the texture cache, which takes texture over from its placeholder (kept
+// for good if the file can't be read).
+void LoadTextureAsync(AssetLoader& loader, TextureCache& cache, const char* path, GLuint texture) {
+	loader.Load([&cache, path, texture]() -> AssetLoader::Upload {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::shared_ptr<DdsFile> dds = std::make_shared<DdsFile>();
+		if (!dds->Open(path)) {
+			return AssetLoader::Upload();
 		}
-	}
+		dds->Prefetch();
+		double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return [&cache, path, texture, dds, load_ms]() { cache.Add(path, texture, dds, load_ms); };
+	});
 }
 
-void CheckCollision() {
-	for (Fireball& fireball : FireballsContainer) {
-		for (Object& object : ObjectsContainer) {
-			float dist = distance(object.pos, fireball.pos);
-			if (dist <= object.size + fireball.size + 1) {
-				fireball.explode = true;
-			}
-			if (dist <= object.size + fireball.size) {
-				fireball.is_alive = false;
-				object.is_alive = false;
+// Where a texture ended up: the array, the unit it stays bound to and the
+// layer to sample.
+struct TextureSlot {
+	GLuint texture;
+	GLint unit;
+	GLint layer;
+};
+
+// Maps the DDS files on a loader thread, then packs those of the same layout
+// into one texture array each (see PackTextureArrays) and binds array g to
+// unit first_unit + g for good. slots[i] is where paths[i] went; until then
+// (or if a file can't be read) it keeps its placeholder.
+void LoadTextureArraysAsync(AssetLoader& loader, TextureCache& cache, const std::vector<const char*>& paths, GLint first_unit, TextureSlot* slots) {
+	loader.Load([&cache, paths, first_unit, slots]() -> AssetLoader::Upload {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::vector<std::shared_ptr<DdsFile> > files;
+		for (const char* path : paths) {
+			std::shared_ptr<DdsFile> dds = std::make_shared<DdsFile>();
+			if (!dds->Open(path)) {
+				return AssetLoader::Upload();
 			}
+			dds->Prefetch();
+			files.push_back(dds);
 		}
-	}
+		std::vector<std::vector<size_t> > groups = PackTextureArrays(files);
+		double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return [&cache, paths, first_unit, slots, files, groups, load_ms]() {
+			for (size_t g = 0; g < groups.size(); ++g) {
+				std::string name;
+				std::vector<std::shared_ptr<DdsFile> > layers;
+				for (size_t i : groups[g]) {
+					name += name.empty() ? paths[i] : std::string("+") + paths[i];
+					layers.push_back(files[i]);
+				}
+				GLuint texture = cache.AddArray(name, layers, load_ms);
+				GLint unit = first_unit + (GLint)g;
+				GLState().BindTextureUnit(unit, GL_TEXTURE_2D_ARRAY, texture);
+				for (size_t layer = 0; layer < groups[g].size(); ++layer) {
+					TextureSlot slot = { texture, unit, (GLint)layer };
+					slots[groups[g][layer]] = slot;
+				}
+			}
+		};
+	});
+}
 
-	for (int i = FireballsContainer.size() - 1; i >= 0; --i) {
-		if (!FireballsContainer[i].is_alive) {
-			FireballsContainer.erase(FireballsContainer.begin() + i);
-		}
-	}
+// Where a textured mesh is and how dense its texture is, for picking the mip
+// levels it needs.
+struct TexelFootprint {
+	vec3 bounds_min;
+	vec3 bounds_max;
+	float units_per_uv;
+};
 
-	for (int i = ObjectsContainer.size() - 1; i >= 0; --i) {
-		if (!ObjectsContainer[i].is_alive) {
-			ObjectsContainer.erase(ObjectsContainer.begin() + i);
-		}
-	}
+// Distance from p to the box, 0 inside it.
+float BoxDistance(const vec3& p, const vec3& bounds_min, const vec3& bounds_max) {
+	return length(max(max(bounds_min - p, p - bounds_max), vec3(0.0f)));
 }
 
-int main(void)
+// The OBJ loader emits three vertices per triangle, so index_count is what the mesh used to cost.
+void ReportMesh(const char* name, const MeshData& mesh) {
+	std::cout << name << ": " << mesh.index_count << " -> " << mesh.vertex_count << " vertices, ACMR 3 -> "
+		<< ComputeACMR(mesh.indices, mesh.index_count, mesh.vertex_count) << "\n";
+}
+
+CollisionGrid ObjectsGrid;
+CollisionScratch ContactScratch;
+// Runs the simulation steps and the per-frame culling; see --jobs.
+JobSystem Jobs;
+
+void CheckCollision() {
+	PROFILE_SCOPE("collide");
+	CollideFireballs(ObjectsContainer, FireballsContainer, ObjectsGrid, ContactScratch, &Jobs);
+	FireballsContainer.RemoveIf([](size_t i) { return !FireballsContainer.is_alive[i]; });
+	ObjectsContainer.RemoveIf([](size_t i) { return !ObjectsContainer.is_alive[i]; });
+}
+
+int main(int argc, char* argv[])
 {
+	// --no-mesh-cache: parse the OBJ files as text instead of using the binary .mesh caches
+	// --gpu-culling: cull the instances on the GPU with transform feedback instead of on the CPU
+	// --benchmark-culling: time both kinds of culling from 1k to 1M instances and exit
+	// --benchmark-transforms: time the enemy vertex shader with quaternions and with rotation matrices and exit
+	// --seed <n>: seed for everything random (default 1)
+	// --record <trace>: write spawns, shots, sim period changes and camera moves to a trace
+	// --replay <trace>: replay a trace's seed and simulation events instead of the input; ends with the trace
+	// --no-lod: draw every fireball with the full sphere.obj
+	// --serial-assets: load every texture and mesh before the first frame, on this thread
+	// --no-shader-cache: compile every shader from source and leave the .glprog binaries alone
+	// --texture-budget <KB>: texture memory to stream mip levels into (default 65536)
+	// --no-pipeline: simulate each frame's steps before drawing it instead of while the frame before is drawn
+	// --jobs <n>: worker threads for the simulation and culling besides this one (default: one per other core, at most 7)
+	// --profile-trace <file>: write every profiler scope as a Chrome trace on exit (builds with ENABLE_PROFILER, see profiler.hpp)
+	// --headless, --input, --report: see headless.hpp
+	bool use_mesh_cache = true;
+	bool use_lod = true;
+	bool serial_assets = false;
+	bool use_shader_cache = true;
+	bool pipeline = true;
+	size_t texture_budget = 64 << 20;
+	int job_workers = (int)std::min(std::max(std::thread::hardware_concurrency(), 1u) - 1, 7u);
+	const char* record_path = NULL;
+#ifdef ENABLE_PROFILER
+	const char* profile_trace_path = NULL;
+#endif
+	bool gpu_culling = false;
+	bool benchmark_culling = false;
+	bool benchmark_transforms = false;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--no-mesh-cache") == 0) {
+			use_mesh_cache = false;
+		}
+		else if (strcmp(argv[i], "--no-lod") == 0) {
+			use_lod = false;
+		}
+		else if (strcmp(argv[i], "--serial-assets") == 0) {
+			serial_assets = true;
+		}
+		else if (strcmp(argv[i], "--no-shader-cache") == 0) {
+			use_shader_cache = false;
+		}
+		else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc) {
+			texture_budget = (size_t)strtoull(argv[++i], NULL, 10) * 1024;
+		}
+		else if (strcmp(argv[i], "--no-pipeline") == 0) {
+			pipeline = false;
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+			job_workers = std::max(atoi(argv[++i]), 0);
+		}
+		else if (strcmp(argv[i], "--gpu-culling") == 0) {
+			gpu_culling = true;
+		}
+		else if (strcmp(argv[i], "--benchmark-culling") == 0) {
+			benchmark_culling = true;
+		}
+		else if (strcmp(argv[i], "--benchmark-transforms") == 0) {
+			benchmark_transforms = true;
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			Rng.Seed(strtoull(argv[++i], NULL, 10));
+		}
+		else if (strcmp(argv[i], "--profile-trace") == 0 && i + 1 < argc) {
+#ifdef ENABLE_PROFILER
+			profile_trace_path = argv[++i];
+#else
+			fprintf(stderr, "--profile-trace %s ignored: this build has no profiler, build with ENABLE_PROFILER\n", argv[++i]);
+#endif
+		}
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			if (!Replay.Open(argv[++i])) {
+				return -1;
+			}
+			Replaying = true;
+			Rng.Seed(Replay.Seed());
+		}
+		else {
+			headless.ParseArg(argc, argv, i);
+		}
+	}
+
+	Jobs.Start(job_workers);
+
 	// Initialise GLFW
-	if (!glfwInit())
+	if (!headless.Init())
 	{
 		fprintf(stderr, "Failed to initialize GLFW\n");
 		getchar();
@@ -161,18 +346,16 @@ int main(void)
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 	// Open a window and create its OpenGL context
-	window = glfwCreateWindow(1024, 768, "Tutorial 04 - Colored Cube", NULL, NULL);
+	window = headless.OpenWindow(WindowWidth, WindowHeight, "Tutorial 04 - Colored Cube");
 	if (window == NULL) {
 		fprintf(stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n");
 		getchar();
 		glfwTerminate();
 		return -1;
 	}
-	glfwMakeContextCurrent(window);
 
 	// Initialize GLEW
-	glewExperimental = true; // Needed for core profile
-	if (glewInit() != GLEW_OK) {
+	if (!headless.InitGlew()) {
 		fprintf(stderr, "Failed to initialize GLEW\n");
 		getchar();
 		glfwTerminate();
@@ -193,51 +376,194 @@ int main(void)
 
 	GLuint VertexArrayID;
 	glGenVertexArrays(1, &VertexArrayID);
-	glBindVertexArray(VertexArrayID);
+	GLState().BindVertexArray(VertexArrayID);
+
+	// Everything the texture and mesh uploads fill in. Until its upload runs a
+	// texture is a 1x1 placeholder and a renderable draws nothing.
+	//
+	// The fireball, floor and sky textures sample from arrays that stay bound
+	// to units 1 and up (unit 0 is for uploads and the font), so the passes
+	// only set which unit and layer; until they load, all three sample a grey
+	// placeholder on unit 1.
+	TextureCache textures(texture_budget);
+	GLuint TexturePlaceholder = CreatePlaceholderTexture(128, 128, 128, 255, GL_TEXTURE_2D_ARRAY);
+	GLState().BindTextureUnit(1, GL_TEXTURE_2D_ARRAY, TexturePlaceholder);
+	enum { SlotFire, SlotFloor, SlotSky, SlotCount };
+	// After the arrays, of which there are at most SlotCount.
+	const GLint ObjectTransformUnit = 1 + SlotCount;
+	TextureSlot texture_slots[SlotCount];
+	for (TextureSlot& slot : texture_slots) {
+		slot.texture = TexturePlaceholder;
+		slot.unit = 1;
+		slot.layer = 0;
+	}
+	GLuint TextureFont = CreatePlaceholderTexture(0, 0, 0, 0);
+	StreamBuffer instance_stream;
+	ResidentColumn object_transforms;
+	ResidentColumn object_positions;
+	Renderable fireball_renderable;
+	Renderable floor_renderable;
+	Renderable sky_renderable;
+	GpuCuller object_culler;
+	GpuCuller fireball_culler;
+	Renderable object_culled_renderable;
+	Renderable fireball_culled_renderable;
+	MeshLodChain fireball_lods;
+	// For culling: how much further than FireballSize the sphere reaches at rest, and how much further per unit of coeff.
+	float fireball_cull_margin = 0.0f;
+	float fireball_explode_reach = 0.0f;
+	float fireball_units_per_uv = 0.0f;
+	TexelFootprint floor_footprint = {};
+	TexelFootprint sky_footprint = {};
+	bool meshes_cached = true;
+	bool assets_failed = false;
+
+	// Textures and meshes are read and parsed on loader threads while the
+	// shaders compile here (compiling needs the context); the first frames draw
+	// with the placeholders. --serial-assets loads them all on this thread first.
+	AssetLoader assets;
+	if (!serial_assets) {
+		assets.Start((int)std::min(std::max(std::thread::hardware_concurrency(), 1u), 4u));
+	}
+	size_t peakBeforeMeshes = PeakResidentBytes();
+	double assetStart = MsSinceStart();
+	std::vector<const char*> array_paths(SlotCount);
+	array_paths[SlotFire] = "fire.DDS";
+	array_paths[SlotFloor] = "floor.DDS";
+	array_paths[SlotSky] = "sky.DDS";
+	LoadTextureArraysAsync(assets, textures, array_paths, 1, texture_slots);
+	LoadTextureAsync(assets, textures, "Holstein.DDS", TextureFont);
+
+	// The fireball mesh with its levels of detail and explosion offsets. The
+	// offsets draw from their own generator, seeded here so the run stays
+	// reproducible whichever thread gets to it.
+	struct FireballMesh {
+		MeshData mesh;
+		MeshLodChain lods;
+		std::vector<MeshVertex> vertices;
+		float radius;
+		float explode_reach;
+		float units_per_uv;
+		double lod_ms;
+	};
+	uint64_t explode_seed = Rng.Next();
+	assets.Load([&, explode_seed]() -> AssetLoader::Upload {
+		std::shared_ptr<FireballMesh> sphere = std::make_shared<FireballMesh>();
+		if (!LoadMesh("sphere.obj", sphere->mesh, use_mesh_cache)) {
+			return [&]() { assets_failed = true; };
+		}
+		const MeshData& mesh = sphere->mesh;
+		sphere->units_per_uv = MinUnitsPerUv(mesh.vertices, mesh.indices, mesh.index_count);
+
+		// Coarser fireballs for far away, as more index ranges over the same vertices.
+		std::chrono::steady_clock::time_point lodStart = std::chrono::steady_clock::now();
+		sphere->lods.Build(mesh.vertices, mesh.vertex_count, mesh.indices, mesh.index_count, FireballLodLevels);
+		sphere->lod_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lodStart).count();
+
+		// The explosion pushes every fireball vertex out along a randomly scaled normal.
+		Random explode_rng(explode_seed);
+		sphere->vertices.assign(mesh.vertices, mesh.vertices + mesh.vertex_count);
+		sphere->radius = 0.0f;
+		sphere->explode_reach = 0.0f;
+		for (MeshVertex& v : sphere->vertices) {
+			float rand_ = explode_rng.UniformInt(0, 9);
+			v.normal = v.normal * rand_;
+			sphere->radius = std::max(sphere->radius, length(v.pos));
+			sphere->explode_reach = std::max(sphere->explode_reach, length(v.normal));
+		}
 
-	// Create and compile our GLSL program from the shaders
-	GLuint programObject = LoadShaders("Object.vertexshader", "Object.fragmentshader");
-	GLuint programFire = LoadShaders("Fireball.vertexshader", "Fireball.fragmentshader");
-	GLuint programID = LoadShaders("TransformVertexShader.vertexshader", "TextureFragmentShaderLOD.fragmentshader");
-	GLuint programIDSky = LoadShaders("TransformVertexShader.vertexshader", "TextureFragmentShaderLOD.fragmentshader");
+		return [&, sphere]() {
+			std::cout << "sphere.obj LODs:";
+			for (const MeshLodChain::Level& level : sphere->lods.levels) {
+				std::cout << " " << level.index_count / 3 << " (error " << level.error << ")";
+			}
+			std::cout << " triangles, " << sphere->lod_ms << " ms\n";
+
+			fireball_lods = std::move(sphere->lods);
+			// The jittered vertices stick out past FireballSize, the collision radius.
+			fireball_cull_margin = std::max(sphere->radius - FireballSize, 0.0f);
+			fireball_explode_reach = sphere->explode_reach;
+			fireball_units_per_uv = sphere->units_per_uv;
+
+			fireball_renderable.Create(&sphere->vertices[0], (GLsizei)sphere->vertices.size(), sizeof(MeshVertex),
+				fireball_lods.indices.data(), (GLsizei)fireball_lods.indices.size());
+			fireball_renderable.SetDrawCount(fireball_lods.levels[0].index_count);
+			fireball_renderable.VertexAttrib(0, 3, offsetof(MeshVertex, pos));
+			fireball_renderable.VertexAttrib(1, 2, offsetof(MeshVertex, uv));
+			fireball_renderable.InstanceAttrib(2, 3, instance_stream.Buffer()); // position
+			fireball_renderable.VertexAttrib(3, 3, offsetof(MeshVertex, normal));
+			fireball_renderable.InstanceAttrib(4, 1, instance_stream.Buffer()); // coeff
+
+			if (gpu_culling) {
+				fireball_culled_renderable.CreateShared(fireball_renderable);
+				fireball_culled_renderable.VertexAttrib(0, 3, offsetof(MeshVertex, pos));
+				fireball_culled_renderable.VertexAttrib(1, 2, offsetof(MeshVertex, uv));
+				fireball_culled_renderable.InstanceAttrib(2, 3, fireball_culler.Output(), fireball_culler.OutputStride(), 0);
+				fireball_culled_renderable.VertexAttrib(3, 3, offsetof(MeshVertex, normal));
+				fireball_culled_renderable.InstanceAttrib(4, 1, fireball_culler.Output(), fireball_culler.OutputStride(), GpuCuller::OutputExtraOffset);
+				fireball_culler.SetDrawCount(fireball_culled_renderable.DrawCount());
+			}
+			ReportMesh("sphere.obj", sphere->mesh);
+			meshes_cached = meshes_cached && sphere->mesh.from_cache;
+		};
+	});
+
+	// The floor and the sky only need reading.
+	struct StaticMesh {
+		const char* path;
+		Renderable* renderable;
+		TexelFootprint* footprint;
+	};
+	StaticMesh static_meshes[] = { { "floor.obj", &floor_renderable, &floor_footprint }, { "sky.obj", &sky_renderable, &sky_footprint } };
+	for (const StaticMesh& static_mesh : static_meshes) {
+		assets.Load([&, static_mesh]() -> AssetLoader::Upload {
+			std::shared_ptr<MeshData> mesh = std::make_shared<MeshData>();
+			if (!LoadMesh(static_mesh.path, *mesh, use_mesh_cache)) {
+				return [&]() { assets_failed = true; };
+			}
+			return [&, static_mesh, mesh]() {
+				Renderable& renderable = *static_mesh.renderable;
+				renderable.Create(mesh->vertices, mesh->vertex_count, sizeof(MeshVertex), mesh->indices, mesh->index_count);
+				renderable.VertexAttrib(0, 3, offsetof(MeshVertex, pos));
+				renderable.VertexAttrib(1, 2, offsetof(MeshVertex, uv));
+				static_mesh.footprint->bounds_min = mesh->bounds_min;
+				static_mesh.footprint->bounds_max = mesh->bounds_max;
+				static_mesh.footprint->units_per_uv = MinUnitsPerUv(mesh->vertices, mesh->indices, mesh->index_count);
+				ReportMesh(static_mesh.path, *mesh);
+				meshes_cached = meshes_cached && mesh->from_cache;
+			};
+		});
+	}
+
+	// Create and compile our GLSL program from the shaders, or load last run's
+	// binaries. The floor and the sky share one program.
+	ShaderManager shaders;
+	shaders.Init(use_shader_cache);
+	GLuint programObject = shaders.Load("Object.vertexshader", "Object.fragmentshader");
+	GLuint programFire = shaders.Load("Fireball.vertexshader", "Fireball.fragmentshader");
+	GLuint programID = shaders.Load("TransformVertexShader.vertexshader", "TextureFragmentShaderLOD.fragmentshader");
+	GLuint programText = shaders.Load("TextVertexShader.vertexshader", "TextVertexShader.fragmentshader");
+	if (!programObject || !programFire || !programID || !programText) {
+		getchar();
+		glfwTerminate();
+		return -1;
+	}
+	std::cout << "shaders: " << shaders.Compiled() << " compiled in " << shaders.CompileMs() << " ms, "
+		<< shaders.FromCache() << " from binaries in " << shaders.CacheMs() << " ms, " << shaders.Shared() << " shared"
+		<< (shaders.UsesBinaries() ? "" : use_shader_cache ? " (no program binary formats)" : " (cache off)") << "\n";
 
 	// Get a handle for our "MVP" uniform
 	GLuint MatrixObject = glGetUniformLocation(programObject, "MVP");
 	GLuint MatrixFire = glGetUniformLocation(programFire, "MVP");
 	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-	GLuint MatrixIDSky = glGetUniformLocation(programIDSky, "MVP");
-
-	// Get a handle for our "myTextureSampler" uniform
-	GLuint TextureID = glGetUniformLocation(programFire, "myTextureSampler");
-	GLuint TextureFloorID = glGetUniformLocation(programID, "myTextureSamplerFloor");
-	GLuint TextureSkyID = glGetUniformLocation(programIDSky, "myTextureSamplerSky");
-
-
-	GLuint Texture = loadDDS("fire.DDS");
-	GLuint TextureFloor = loadDDS("floor.DDS");
-	GLuint TextureSky = loadDDS("sky.DDS");
-
-	// Read our .obj file
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec2> uvs;
-	std::vector<glm::vec3> normals; // Won't be used at the moment.
-	std::vector<glm::vec3> normals_fireball;
-	bool res = loadOBJ("sphere.obj", vertices, uvs, normals);
-	for (vec3 n : normals) {
-		float rand_ = rand() % 10;
-		vec3 new_n = vec3(n) * rand_;
-		normals_fireball.push_back(new_n);
-	}
-
-	std::vector<glm::vec3> vertices_floor;
-	std::vector<glm::vec2> uvs_floor;
-	std::vector<glm::vec3> normals_floor; // Won't be used at the moment.
-	bool res1 = loadOBJ("floor.obj", vertices_floor, uvs_floor, normals_floor);
 
-	std::vector<glm::vec3> vertices_sky;
-	std::vector<glm::vec2> uvs_sky;
-	std::vector<glm::vec3> normals_sky; // Won't be used at the moment.
-	bool res2 = loadOBJ("sky.obj", vertices_sky, uvs_sky, normals_sky);
+	// Get a handle for the texture array sampler and layer uniforms
+	GLuint TextureFireID = glGetUniformLocation(programFire, "textureLayers");
+	GLuint LayerFireID = glGetUniformLocation(programFire, "layer");
+	GLuint TextureID = glGetUniformLocation(programID, "textureLayers");
+	GLuint LayerID = glGetUniformLocation(programID, "layer");
+	GLState().UseProgram(programObject);
+	GLState().Uniform1i(glGetUniformLocation(programObject, "transforms"), ObjectTransformUnit);
 
 	// Our vertices. Tree consecutive floats give a 3D vertex; Three consecutive vertices give a triangle.
 	// A cube has 6 faces with 2 triangles each, so this makes 6*2=12 triangles, and 12*3 vertices
@@ -278,91 +604,104 @@ int main(void)
 	static GLfloat g_color_buffer_data[8 * 3 * 3];
 	for (int v = 0; v < 8 * 3; v++) {
 		g_color_buffer_data[3 * v + 0] = 0.7f;
-		g_color_buffer_data[3 * v + 1] = (double)rand() / (RAND_MAX);
+		g_color_buffer_data[3 * v + 1] = Rng.Uniform01();
 		g_color_buffer_data[3 * v + 2] = 1.0f;
 	}
 
-	static std::vector<vec3> g_obj_position_data(MaxObjects);
-	static std::vector<vec4> g_obj_quat_data(MaxObjects);
-
-	GLuint object_vertexbuffer;
-	glGenBuffers(1, &object_vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, object_vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
-
-	GLuint objects_position_buffer;
-	glGenBuffers(1, &objects_position_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, objects_position_buffer);
-	glBufferData(GL_ARRAY_BUFFER, MaxObjects * sizeof(vec3), nullptr, GL_STREAM_DRAW);
-
-	GLuint object_colorbuffer;
-	glGenBuffers(1, &object_colorbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, object_colorbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(g_color_buffer_data), g_color_buffer_data, GL_STATIC_DRAW);
-
-	GLuint object_quat_buffer;
-	glGenBuffers(1, &object_quat_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, object_quat_buffer);
-	glBufferData(GL_ARRAY_BUFFER, MaxObjects * sizeof(vec4), nullptr, GL_STREAM_DRAW);
-
-
-
-
-	static std::vector<vec3> g_fireball_position_data(MaxFireballs);
-	static std::vector<float> g_fireball_coeff_data(MaxFireballs);
-
-	GLuint fireball_vertex_buffer;
-	glGenBuffers(1, &fireball_vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, fireball_vertex_buffer);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec3), &vertices[0], GL_STREAM_DRAW);
-
-	GLuint fireball_position_buffer;
-	glGenBuffers(1, &fireball_position_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, fireball_position_buffer);
-	glBufferData(GL_ARRAY_BUFFER, MaxFireballs * sizeof(vec3), nullptr, GL_STREAM_DRAW);
-
-
-	GLuint fireball_coeff_buffer;
-	glGenBuffers(1, &fireball_coeff_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, fireball_coeff_buffer);
-	glBufferData(GL_ARRAY_BUFFER, MaxFireballs * sizeof(float), nullptr, GL_STREAM_DRAW);
-
-	GLuint fireball_uvbuffer;
-	glGenBuffers(1, &fireball_uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, fireball_uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(vec2), &uvs[0], GL_STATIC_DRAW);
-
-	GLuint fireball_normal_buffer;
-	glGenBuffers(1, &fireball_normal_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, fireball_normal_buffer);
-	glBufferData(GL_ARRAY_BUFFER, normals_fireball.size() * sizeof(vec3), &normals_fireball[0], GL_STATIC_DRAW);
-
-	GLuint vertexbuffer_floor;
-	glGenBuffers(1, &vertexbuffer_floor);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_floor);
-	glBufferData(GL_ARRAY_BUFFER, vertices_floor.size() * sizeof(glm::vec3), &vertices_floor[0], GL_STATIC_DRAW);
+	// The cube is interleaved position/color.
+	static GLfloat g_object_vertex_data[8 * 3 * 6];
+	float object_radius = 0.0f;
+	for (int v = 0; v < 8 * 3; v++) {
+		memcpy(&g_object_vertex_data[6 * v + 0], &g_vertex_buffer_data[3 * v], 3 * sizeof(GLfloat));
+		memcpy(&g_object_vertex_data[6 * v + 3], &g_color_buffer_data[3 * v], 3 * sizeof(GLfloat));
+		object_radius = std::max(object_radius, length(vec3(g_vertex_buffer_data[3 * v], g_vertex_buffer_data[3 * v + 1], g_vertex_buffer_data[3 * v + 2])));
+	}
+	// ObjectSize is what collides; the cube's corners reach past it, and culling
+	// pads by the difference (as for the fireballs' jitter).
+	float object_cull_margin = std::max(object_radius - ObjectSize, 0.0f);
+
+	// Per-instance object indices and fireball positions and coeffs, rewritten
+	// every frame. Room for every stream at full capacity plus alignment padding.
+	instance_stream.Create(MaxObjects * sizeof(GLuint) + MaxFireballs * (sizeof(vec3) + sizeof(float)) + 4 * 16);
+
+	// The enemies' transforms stay on the GPU, patched where one spawns or
+	// dies, and the object pass fetches them by index from a buffer texture
+	// left bound to its own unit.
+	object_transforms.Create(MaxObjects, sizeof(PackedTransform), GL_RGBA32F);
+	GLState().BindTextureUnit(ObjectTransformUnit, GL_TEXTURE_BUFFER, object_transforms.Texture());
+
+	// One VAO per mesh, with the attribute layout the matching vertex shader expects.
+	Renderable object_renderable;
+	object_renderable.Create(g_object_vertex_data, 8 * 3, 6 * sizeof(GLfloat));
+	object_renderable.VertexAttrib(0, 3, 0);                   // vertexPosition_modelspace
+	object_renderable.InstanceAttribI(1, 1, instance_stream.Buffer()); // instance
+	object_renderable.VertexAttrib(2, 3, 3 * sizeof(GLfloat)); // vertexColor
+
+	if (benchmark_culling) {
+		BenchmarkCulling(g_object_vertex_data, 8 * 3, programObject, MatrixObject, ObjectTransformUnit, ObjectSize + object_cull_margin);
+		glfwTerminate();
+		return 0;
+	}
 
-	GLuint uvbuffer_floor;
-	glGenBuffers(1, &uvbuffer_floor);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer_floor);
-	glBufferData(GL_ARRAY_BUFFER, uvs_floor.size() * sizeof(glm::vec2), &uvs_floor[0], GL_STATIC_DRAW);
+	if (benchmark_transforms) {
+		BenchmarkTransforms(g_object_vertex_data, 8 * 3, programObject, ObjectTransformUnit, shaders.Load("ObjectQuaternion.vertexshader", "Object.fragmentshader"));
+		glfwTerminate();
+		return 0;
+	}
 
-	GLuint vertexbuffer_sky;
-	glGenBuffers(1, &vertexbuffer_sky);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_sky);
-	glBufferData(GL_ARRAY_BUFFER, vertices_sky.size() * sizeof(glm::vec3), &vertices_sky[0], GL_STATIC_DRAW);
+	// --gpu-culling: every fireball is uploaded and the cull passes write the
+	// visible instances to their own buffers, drawn through these second VAOs.
+	// The object pass culls a resident copy of the positions and writes the
+	// indices of the visible ones.
+	if (gpu_culling) {
+		object_positions.Create(MaxObjects, sizeof(vec3));
+		if (!object_culler.Create("Cull.vertexshader", "CullIndex.geometryshader", MaxObjects, GpuCuller::OutputIndex) ||
+			!fireball_culler.Create("Cull.vertexshader", "Cull.geometryshader", MaxFireballs)) {
+			getchar();
+			glfwTerminate();
+			return -1;
+		}
+		object_culled_renderable.CreateShared(object_renderable);
+		object_culled_renderable.VertexAttrib(0, 3, 0);
+		object_culled_renderable.InstanceAttribI(1, 1, object_culler.Output());
+		object_culled_renderable.VertexAttrib(2, 3, 3 * sizeof(GLfloat));
+		object_culler.SetDrawCount(object_culled_renderable.DrawCount());
+	}
 
-	GLuint uvbuffer_sky;
-	glGenBuffers(1, &uvbuffer_sky);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer_sky);
-	glBufferData(GL_ARRAY_BUFFER, uvs_sky.size() * sizeof(glm::vec2), &uvs_sky[0], GL_STATIC_DRAW);
+	// The HUD, drawn in one call after the scene.
+	TextBatch hud;
+	hud.Create(programText, TextureFont);
+
+#ifdef ENABLE_PROFILER
+	Profiler& profiler = Profiler::Get();
+	profiler.Create();
+#endif
+
+	// Printed once the last texture or mesh is uploaded.
+	auto ReportAssets = [&]() {
+		size_t peakAfterMeshes = PeakResidentBytes();
+		std::cout << "assets: ready " << MsSinceStart() - assetStart << " ms after loading started, "
+			<< MsSinceStart() << " ms after start (" << (serial_assets ? "serial" : std::to_string(assets.Threads()) + " loader threads")
+			<< "), meshes from " << (meshes_cached ? "binary cache" : "obj") << ", peak RSS " << peakAfterMeshes / (1024 * 1024) << " MB (+"
+			<< (peakAfterMeshes - peakBeforeMeshes) / 1024 << " KB)\n";
+	};
+	if (serial_assets) {
+		assets.Finish();
+		if (assets_failed) {
+			getchar();
+			glfwTerminate();
+			return -1;
+		}
+		ReportAssets();
+	}
 
-	double lastTime = glfwGetTime();
+	double lastTime = headless.Time();
 	double createTime = 2.0f;
 	double showInfoTime = 2.0f;
 
-	double globalTime = glfwGetTime();
+	double globalTime = headless.Time();
 	double delta = 0.025f;
+	double reportTime = globalTime;
 
 	bool mouse_left_pressed = false;
 	bool mouse_left_released = true;
@@ -371,72 +710,214 @@ int main(void)
 	bool mouse_mid_pressed = false;
 	bool mouse_mid_released = true;
 
-	double showTime = 0.0f;
 	double delay = 0.05f;
+	if (Replaying) {
+		delay = Replay.Period();
+		if (Replay.Step() != delta) {
+			fprintf(stderr, "The trace was recorded with %g s steps, this build takes %g s steps\n", Replay.Step(), delta);
+		}
+	}
+	if (record_path != NULL && !Recorder.Open(record_path, Rng.GetSeed(), delta, delay)) {
+		getchar();
+		glfwTerminate();
+		return -1;
+	}
+
+	// The simulation advances by delta every delay seconds of wall time, whatever
+	// the frame rate; frames interpolate between the last two steps.
+	FixedTimestep sim_clock(delta, delay);
+	FrameStats frame_stats;
+
+	// Two stages. Input sampling and drawing run here; the simulation runs as
+	// a job that takes the frame's input from input_queue and leaves what is
+	// drawn in snapshots. Pipelined, frame N's steps run while frame N-1 is
+	// drawn, a frame later on screen; otherwise each frame waits for its own.
+	// Only the simulation job touches the entity stores, sim_clock, delay,
+	// createTime and the trace once the loop runs.
+	SpscQueue<InputEvent, 256> input_queue;
+	SnapshotBuffer snapshots;
+	JobGroup sim_job;
+	std::vector<InputEvent> pending_shots;
+	auto Simulate = [&]() {
+		PROFILE_SCOPE("simulate");
+		FrameSnapshot& snapshot = snapshots.Back();
+		snapshot.shots.clear();
+		InputEvent input;
+		while (input_queue.Pop(input)) {
+			if (input.type == InputEvent::Slower || input.type == InputEvent::Faster) {
+				if (input.type == InputEvent::Slower) {
+					delay += 0.05f;
+				}
+				else if (delay >= 0.05f) {
+					delay -= 0.05f;
+				}
+				sim_clock.SetPeriod(delay);
+				Recorder.Period(SimSteps, delay);
+				continue;
+			}
+			if (input.type == InputEvent::Shot) {
+				pending_shots.push_back(input);
+				continue;
+			}
+
+			int steps = sim_clock.Advance(input.time);
+			for (int step = 0; step < steps && !(Replaying && Replay.Finished(SimSteps)); ++step, ++SimSteps) {
+				if (Replaying) {
+					while (const TraceEvent* event = Replay.Next(SimSteps, TraceCamera, TracePeriod)) {
+						if (event->type == TraceCamera) {
+							SimCamera = event->pos;
+						}
+						else {
+							delay = event->period;
+							sim_clock.SetPeriod(delay);
+						}
+					}
+				}
+				else {
+					SimCamera = input.camera_pos;
+					SimCameraDirection = input.camera_dir;
+					Recorder.Camera(SimSteps, SimCamera);
+				}
 
-	initText2D("Holstein.DDS");
+				RemoveFarFireballs();
+				CheckCollision();
+
+				createTime += delta;
+
+				{
+					PROFILE_SCOPE("spawn");
+					if (Replaying) {
+						while (const TraceEvent* event = Replay.Next(SimSteps, TraceSpawn, TraceShot)) {
+							if (event->type == TraceSpawn) {
+								AddObject(event->pos, event->quat);
+							}
+							else {
+								AddFireball(event->pos, vec3(event->quat));
+							}
+						}
+					}
+					else {
+						if (createTime >= 3.0f && ObjectsContainer.Count() < MaxObjects) {
+							InstantiateObject();
+							createTime = 0.0f;
+						}
+
+						for (const InputEvent& shot : pending_shots) {
+							InstantiateFireball();
+							snapshot.shots.push_back(shot);
+						}
+						pending_shots.clear();
+					}
+				}
+
+				PROFILE_SCOPE("move");
+				MoveFireballs(FireballsContainer, (float)delta, &Jobs);
+			}
+		}
+		PROFILE_SCOPE("capture");
+		snapshot.Capture(ObjectsContainer, FireballsContainer);
+		snapshot.alpha = sim_clock.Alpha();
+		snapshot.period = sim_clock.Period();
+		snapshot.sim_steps = SimSteps;
+		snapshot.replay_finished = Replaying && Replay.Finished(SimSteps);
+	};
+	uint64_t frame_index = 0;
+	auto PushInput = [&](InputEvent::Type type, double time) {
+		InputEvent input = { type, frame_index, time, MsSinceStart(), getCameraPosition(), getCameraDirection() };
+		if (!input_queue.Push(input)) {
+			fprintf(stderr, "input queue full, input dropped\n");
+		}
+	};
+	// Sample to screen, over every shot drawn so far.
+	unsigned long latency_shots = 0;
+	double latency_frames = 0.0;
+	double latency_ms = 0.0;
+	// Per-frame culling scratch.
+	std::vector<uint32_t> visible_objects;
+	std::vector<uint32_t> visible_fireballs;
+	std::vector<vec3> fireball_draw_pos;
+	std::vector<float> fireball_draw_coeff;
+	std::vector<float> fireball_draw_radius;
+	std::vector<uint8_t> visible_fireball_lod;
+	std::vector<uint32_t> fireballs_by_lod;
+	// Visible fireballs per level of detail, and where each level's start in the instance data.
+	size_t lod_count[FireballLodLevels] = {};
+	size_t lod_first[FireballLodLevels] = {};
+	// Both instance passes are opaque, so they draw nearest first for early-Z.
+	DepthOrder object_order(DepthOrder::FrontToBack);
+	DepthOrder fireball_order(DepthOrder::FrontToBack);
+	// Refilled and drawn every frame.
+	DrawQueue opaque_passes;
+	// Don't draw faster than this when vsync isn't pacing the swap.
+	const double MinFramePeriod = 1.0 / 120.0;
+	if (!headless.Enabled()) {
+		glfwSwapInterval(1);
+	}
+
+	bool first_frame = true;
 	do {
-		double currentGlobal = glfwGetTime();
+#ifdef COUNT_GL_CALLS
+		unsigned long frameGLCalls = GLCallCount();
+#endif
+		unsigned long frameStateIssued = GLState().Issued();
+		unsigned long frameStateSkipped = GLState().Skipped();
+		headless.BeginFrame();
+#ifdef ENABLE_PROFILER
+		profiler.BeginFrame();
+#endif
+		// Whatever finished loading since last frame replaces its placeholder.
+		if (!assets.Idle() && assets.Pump() > 0 && assets.Idle()) {
+			if (assets_failed) {
+				break;
+			}
+			ReportAssets();
+		}
+		double currentGlobal = headless.Time();
 		double deltaG = currentGlobal - globalTime;
 		if (showInfoTime <= 5.0f) {
 			showInfoTime += deltaG;
-			// printText2D("SHOOT - middle click", 0, 550, 20);
+			// hud.Print("SHOOT - middle click", 0, 550, 20);
 		}
 		globalTime = currentGlobal;
-		showTime += deltaG;
-
-		if (showTime <= delay) {
-			continue;
-		}
+		frame_stats.AddFrame(deltaG);
 
-		showTime = 0.0f;
-
-		if (mouse_left_released && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+		if (mouse_left_released && headless.MouseButton(GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
 			mouse_left_pressed = true;
 			mouse_left_released = false;
 		}
 
-		if (mouse_left_pressed && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_RELEASE) {
+		if (mouse_left_pressed && headless.MouseButton(GLFW_MOUSE_BUTTON_LEFT) == GLFW_RELEASE) {
 			mouse_left_pressed = false;
 			mouse_left_released = true;
-			delay += 0.05f;
+			if (!Replaying) {
+				PushInput(InputEvent::Slower, currentGlobal);
+			}
 		}
-		if (mouse_right_released && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
+		if (mouse_right_released && headless.MouseButton(GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
 			mouse_right_pressed = true;
 			mouse_right_released = false;
 		}
 
-		if (mouse_right_pressed && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_RELEASE) {
+		if (mouse_right_pressed && headless.MouseButton(GLFW_MOUSE_BUTTON_RIGHT) == GLFW_RELEASE) {
 			mouse_right_pressed = false;
 			mouse_right_released = true;
-			if (delay >= 0.05f) {
-				delay -= 0.05f;
+			if (!Replaying) {
+				PushInput(InputEvent::Faster, currentGlobal);
 			}
 		}
-		// Clear the screen
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		RemoveFarFireballs();
-		CheckCollision();
-
-		createTime += delta;
 
-		if (createTime >= 3.0f && ObjectsContainer.size() <= MaxObjects) {
-			InstantiateObject();
-			SortObjects();
-			createTime = 0.0f;
-		}
-
-		if (mouse_mid_released && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS) {
+		if (mouse_mid_released && headless.MouseButton(GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS) {
 			mouse_mid_pressed = true;
 			mouse_mid_released = false;
 		}
 
-		if (mouse_mid_pressed && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_RELEASE) {
+		if (mouse_mid_pressed && headless.MouseButton(GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_RELEASE) {
 			mouse_mid_pressed = false;
 			mouse_mid_released = true;
-			std::cout << "shoot\n";
-			InstantiateFireball();
+			if (!Replaying) {
+				std::cout << "shoot\n";
+				PushInput(InputEvent::Shot, currentGlobal);
+			}
 		}
 
 		computeMatricesFromInputs();
@@ -445,323 +926,373 @@ int main(void)
 		glm::mat4 ModelMatrix = glm::mat4(1.0);
 		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
 
-		for (int i = 0; i < ObjectsContainer.size(); ++i) {
-			Object& object = ObjectsContainer[i];
-			g_obj_position_data[i] = object.pos;
-			g_obj_quat_data[i] = object.quat;
-		}
-
-		glBindBuffer(GL_ARRAY_BUFFER, objects_position_buffer);
-		glBufferData(GL_ARRAY_BUFFER, MaxObjects * sizeof(vec3), nullptr, GL_STREAM_DRAW);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, ObjectsContainer.size() * sizeof(vec3), &g_obj_position_data[0]);
-
-		glBindBuffer(GL_ARRAY_BUFFER, object_quat_buffer);
-		glBufferData(GL_ARRAY_BUFFER, MaxObjects * sizeof(vec4), nullptr, GL_STREAM_DRAW);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, ObjectsContainer.size() * sizeof(vec4), &g_obj_quat_data[0]);
-
-		glUseProgram(programObject);
-
-		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixObject, 1, GL_FALSE, &MVP[0][0]);
-
-		// 1 attribute buffer : object_vertexbuffer
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, object_vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2 attribute buffer : objects_position_buffer
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, objects_position_buffer);
-		glVertexAttribPointer(
-			1,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 3 attribute buffer : object_colorbuffer
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, object_colorbuffer);
-		glVertexAttribPointer(
-			2,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 4 attribute buffer : object_quat_buffer
-		glEnableVertexAttribArray(3);
-		glBindBuffer(GL_ARRAY_BUFFER, object_quat_buffer);
-		glVertexAttribPointer(
-			3,                  // attribute
-			4,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		glVertexAttribDivisor(0, 0);
-		glVertexAttribDivisor(1, 1);
-		glVertexAttribDivisor(2, 0);
-		glVertexAttribDivisor(3, 1);
-
-		glDrawArraysInstanced(GL_TRIANGLES, 0, 8 * 3, ObjectsContainer.size());
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
-		glDisableVertexAttribArray(3);
-
-		for (int i = 0; i < FireballsContainer.size(); ++i) {
-			Fireball& fireball = FireballsContainer[i];
-			fireball.pos += fireball.dir * fireball.speed * (float)delta;
-			g_fireball_position_data[i] = fireball.pos;
-			if (fireball.explode) {
-				if (fireball.coeff < 1.0f) {
-					fireball.coeff += 0.1f;
+		// The frame's input is complete: the steps due now can run.
+		PushInput(InputEvent::Frame, currentGlobal);
+		if (pipeline) {
+			PROFILE_SCOPE("wait sim");
+			Jobs.Wait(sim_job);
+			snapshots.Publish();
+		}
+		Jobs.Run(sim_job, Simulate);
+
+		// Clear the screen
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		FrustumPlanes frustum = ExtractFrustumPlanes(ProjectionMatrix * ViewMatrix);
+		vec3 eye = getCameraPosition();
+		vec3 forward = getCameraDirection();
+		vec3 view_axis = normalize(forward);
+		float pixels_at_unit_depth = ProjectionMatrix[1][1] * WindowHeight / 2;
+
+		// Stream in the mip levels this frame samples: each texture's densest
+		// spot at the nearest depth it is drawn at. The floor, sky and font
+		// don't move; the fireballs are requested once they are simulated.
+		const TexelFootprint* footprints[] = { &floor_footprint, &sky_footprint };
+		GLuint footprint_textures[] = { texture_slots[SlotFloor].texture, texture_slots[SlotSky].texture };
+		for (int i = 0; i < 2; ++i) {
+			float depth = std::max(BoxDistance(eye, footprints[i]->bounds_min, footprints[i]->bounds_max), 0.1f);
+			textures.Request(footprint_textures[i], footprints[i]->units_per_uv * pixels_at_unit_depth / depth, -2.0f);
+		}
+		// A character is a 16th of the font; the largest HUD text is 60 units of 600 high.
+		textures.Request(TextureFont, 16.0f * 60.0f * WindowHeight / 600.0f, 0.0f);
+
+		if (!pipeline) {
+			PROFILE_SCOPE("wait sim");
+			Jobs.Wait(sim_job);
+			snapshots.Publish();
+		}
+		const FrameSnapshot& snapshot = snapshots.Front();
+
+		// Cull the instances against this frame's view; only the visible ones are drawn.
+		size_t total_objects = snapshot.ObjectCount();
+		size_t total_fireballs = snapshot.FireballCount();
+		size_t num_objects = total_objects;
+		size_t num_fireballs = total_fireballs;
+		fireball_draw_pos.resize(total_fireballs);
+		fireball_draw_coeff.resize(total_fireballs);
+		InterpolateFireballs(snapshot.fireball_prev_pos.data(), snapshot.fireball_pos.data(), snapshot.fireball_coeff.data(), total_fireballs,
+			snapshot.alpha, fireball_draw_pos.data(), fireball_draw_coeff.data(), &Jobs);
+
+		// Enemies don't move: only the slots written since the last snapshot go
+		// to the GPU's copy.
+		size_t object_bytes = 0;
+		{
+			PROFILE_SCOPE("patch enemies");
+			object_bytes += object_transforms.Patch(snapshot.object_transform.data(), total_objects, snapshot.object_changes);
+			if (gpu_culling) {
+				object_bytes += object_positions.Patch(snapshot.object_pos.data(), total_objects, snapshot.object_changes);
+			}
+		}
+
+		// Re-sort last frame's draw orders for this frame's camera.
+		fireball_order.Update(reinterpret_cast<const float*>(fireball_draw_pos.data()), total_fireballs, eye, forward);
+
+		GLintptr object_index_offset, fireball_position_offset, fireball_coeff_offset;
+		GLsizei culled_fireballs = (GLsizei)total_fireballs;
+		if (gpu_culling) {
+			// The fireballs are uploaded in draw order; the cull passes compact the
+			// visible instances on the GPU and keep their order. The objects are
+			// culled where they sit, in store order.
+			PROFILE_SCOPE("cull");
+			{
+				PROFILE_SCOPE("upload");
+				instance_stream.Begin();
+				vec3* fireball_position_out = (vec3*)instance_stream.Allocate(total_fireballs * sizeof(vec3), &fireball_position_offset);
+				float* fireball_coeff_out = (float*)instance_stream.Allocate(total_fireballs * sizeof(float), &fireball_coeff_offset);
+				if (fireball_position_out != nullptr && fireball_coeff_out != nullptr) {
+					GatherInstances(fireball_position_out, fireball_draw_pos.data(), fireball_order.Order(), total_fireballs);
+					GatherInstances(fireball_coeff_out, fireball_draw_coeff.data(), fireball_order.Order(), total_fireballs);
 				}
-				g_fireball_coeff_data[i] = fireball.coeff;
+				else {
+					// Full, or the slice failed to map: no fireballs this frame.
+					fprintf(stderr, "instance stream unavailable, fireballs skipped\n");
+					culled_fireballs = 0;
+				}
+				instance_stream.End();
+			}
+
+			PROFILE_GPU_SCOPE("gpu cull");
+			object_culler.Cull(object_positions.Buffer(), 0, 0, 0, (GLsizei)total_objects,
+				frustum, ObjectSize + object_cull_margin, 0.0f);
+			fireball_culler.Cull(instance_stream.Buffer(), fireball_position_offset, fireball_coeff_offset, 1, culled_fireballs,
+				frustum, FireballSize + fireball_cull_margin, fireball_explode_reach);
+		}
+		else {
+			// Only the visible instances are uploaded, in draw order; for the
+			// objects that is just their indices.
+			PROFILE_SCOPE("cull");
+			object_order.Update(reinterpret_cast<const float*>(snapshot.object_pos.data()), total_objects, eye, forward);
+			visible_objects.resize(total_objects);
+			num_objects = CullSpheresParallel(&Jobs, SimGrain, reinterpret_cast<const float*>(snapshot.object_pos.data()),
+				snapshot.object_size.data(), object_cull_margin, total_objects, frustum, visible_objects.data());
+			num_objects = object_order.Sort(visible_objects.data(), num_objects);
+
+			fireball_draw_radius.resize(total_fireballs);
+			visible_fireballs.resize(total_fireballs);
+			for (size_t i = 0; i < total_fireballs; ++i) {
+				fireball_draw_radius[i] = snapshot.fireball_size[i] + fireball_draw_coeff[i] * fireball_explode_reach;
+			}
+			num_fireballs = CullSpheresParallel(&Jobs, SimGrain, reinterpret_cast<const float*>(fireball_draw_pos.data()),
+				fireball_draw_radius.data(), fireball_cull_margin, total_fireballs, frustum, visible_fireballs.data());
+			num_fireballs = fireball_order.Sort(visible_fireballs.data(), num_fireballs);
+
+			// Bucket the visible fireballs by level of detail, each bucket still in draw order.
+			// A model-space error e covers e * pixels_at_unit_depth / depth pixels.
+			std::fill(lod_count, lod_count + FireballLodLevels, 0);
+			visible_fireball_lod.resize(num_fireballs);
+			for (size_t k = 0; k < num_fireballs; ++k) {
+				float depth = std::max(dot(fireball_draw_pos[visible_fireballs[k]] - eye, view_axis), 0.1f);
+				int level = use_lod ? fireball_lods.Select(LodPixelError * depth / pixels_at_unit_depth) : 0;
+				visible_fireball_lod[k] = (uint8_t)level;
+				++lod_count[level];
+			}
+			for (int level = 1; level < FireballLodLevels; ++level) {
+				lod_first[level] = lod_first[level - 1] + lod_count[level - 1];
+			}
+			fireballs_by_lod.resize(num_fireballs);
+			size_t lod_fill[FireballLodLevels];
+			std::copy(lod_first, lod_first + FireballLodLevels, lod_fill);
+			for (size_t k = 0; k < num_fireballs; ++k) {
+				fireballs_by_lod[lod_fill[visible_fireball_lod[k]]++] = visible_fireballs[k];
+			}
+			visible_fireballs.swap(fireballs_by_lod);
+
+			// This frame's instance data goes straight into the mapped stream buffer.
+			PROFILE_SCOPE("upload");
+			instance_stream.Begin();
+			uint32_t* object_index_out = (uint32_t*)instance_stream.Allocate(num_objects * sizeof(uint32_t), &object_index_offset);
+			vec3* fireball_position_out = (vec3*)instance_stream.Allocate(num_fireballs * sizeof(vec3), &fireball_position_offset);
+			float* fireball_coeff_out = (float*)instance_stream.Allocate(num_fireballs * sizeof(float), &fireball_coeff_offset);
+			if (object_index_out != nullptr && fireball_position_out != nullptr && fireball_coeff_out != nullptr) {
+				memcpy(object_index_out, visible_objects.data(), num_objects * sizeof(uint32_t));
+				object_bytes += num_objects * sizeof(uint32_t);
+				GatherInstances(fireball_position_out, fireball_draw_pos.data(), visible_fireballs.data(), num_fireballs);
+				GatherInstances(fireball_coeff_out, fireball_draw_coeff.data(), visible_fireballs.data(), num_fireballs);
 			}
 			else {
-				g_fireball_coeff_data[i] = 0;
+				// Full, or the slice failed to map: no instances this frame.
+				fprintf(stderr, "instance stream unavailable, instances skipped\n");
+				num_objects = 0;
+				num_fireballs = 0;
+				std::fill(lod_count, lod_count + FireballLodLevels, 0);
 			}
+			instance_stream.End();
 		}
 
-		glBindBuffer(GL_ARRAY_BUFFER, fireball_position_buffer);
-		glBufferData(GL_ARRAY_BUFFER, MaxFireballs * sizeof(vec3), nullptr, GL_STREAM_DRAW);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, FireballsContainer.size() * sizeof(vec3), &g_fireball_position_data[0]);
-
-		glBindBuffer(GL_ARRAY_BUFFER, fireball_coeff_buffer);
-		glBufferData(GL_ARRAY_BUFFER, MaxFireballs * sizeof(float), nullptr, GL_STREAM_DRAW);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, FireballsContainer.size() * sizeof(float), &g_fireball_coeff_data[0]);
-
-
-		glUseProgram(programFire);
-		glUniformMatrix4fv(MatrixFire, 1, GL_FALSE, &MVP[0][0]);
-
-		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Texture);
-		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureID, 0);
-
-		// 1 attribute buffer : fireball_vertex_buffer
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, fireball_vertex_buffer);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2 attribute buffer : fireball_uvbuffer
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, fireball_uvbuffer);
-		glVertexAttribPointer(
-			1,                  // attribute
-			2,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 3 attribute buffer : fireball_position_buffer
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, fireball_position_buffer);
-		glVertexAttribPointer(
-			2,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 4 attribute buffer : fireball_normal_buffer
-		glEnableVertexAttribArray(3);
-		glBindBuffer(GL_ARRAY_BUFFER, fireball_normal_buffer);
-		glVertexAttribPointer(
-			3,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 5 attribute buffer : fireball_coeff_buffer
-		glEnableVertexAttribArray(4);
-		glBindBuffer(GL_ARRAY_BUFFER, fireball_coeff_buffer);
-		glVertexAttribPointer(
-			4,                  // attribute
-			1,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		glVertexAttribDivisor(0, 0);
-		glVertexAttribDivisor(1, 0);
-		glVertexAttribDivisor(2, 1);
-		glVertexAttribDivisor(3, 0);
-		glVertexAttribDivisor(4, 1);
-
-		glDrawArraysInstanced(GL_TRIANGLES, 0, vertices.size(), FireballsContainer.size());
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
-		glDisableVertexAttribArray(3);
-		glDisableVertexAttribArray(4);
-
-		// Use our shader
-		glUseProgram(programID);
-
-		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, TextureFloor);
-		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureFloorID, 0);
-
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_floor);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer_floor);
-		glVertexAttribPointer(
-			1,                                // attribute
-			2,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// Draw the triangles !
-		glDrawArrays(GL_TRIANGLES, 0, vertices_floor.size());
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-
-		// Use our shader
-		glUseProgram(programIDSky);
-
-		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixIDSky, 1, GL_FALSE, &MVP[0][0]);
-
-		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, TextureSky);
-		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureSkyID, 0);
-
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_sky);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer_sky);
-		glVertexAttribPointer(
-			1,                                // attribute
-			2,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// Draw the triangles !
-		glDrawArrays(GL_TRIANGLES, 0, vertices_sky.size());
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-
-		printText2D(".", 400, 300, 60);
-		std::string numberEnemies = std::to_string(ObjectsContainer.size());
-		printText2D("Num of enemies:", 10, 100, 14);
-		printText2D(numberEnemies.c_str(), 80, 50, 30);
+		float nearest_fireball = FLT_MAX;
+		for (size_t i = 0; i < total_fireballs; ++i) {
+			float reach = FireballSize + fireball_cull_margin + fireball_draw_coeff[i] * fireball_explode_reach;
+			nearest_fireball = std::min(nearest_fireball, dot(fireball_draw_pos[i] - eye, view_axis) - reach);
+		}
+		if (total_fireballs > 0) {
+			textures.Request(texture_slots[SlotFire].texture, fireball_units_per_uv * pixels_at_unit_depth / std::max(nearest_fireball, 0.1f), 0.0f);
+		}
+		textures.Update();
+
+		// Each program gets this frame's MVP with its first draw.
+		GLuint mvp_programs[3];
+		int mvp_count = 0;
+		auto UseProgramMVP = [&](GLuint program, GLint mvp_location) {
+			GLState().UseProgram(program);
+			if (std::find(mvp_programs, mvp_programs + mvp_count, program) == mvp_programs + mvp_count) {
+				glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &MVP[0][0]);
+				mvp_programs[mvp_count++] = program;
+			}
+		};
+
+		// The opaque passes, grouped by program and texture: the instances,
+		// then the floor and the sky behind them, for early-Z.
+		opaque_passes.Add(0, programObject, object_transforms.Texture(), [&]() {
+			PROFILE_GPU_SCOPE("enemies");
+			UseProgramMVP(programObject, MatrixObject);
+			if (!gpu_culling) {
+				GLintptr object_offsets[] = { object_index_offset };
+				object_renderable.DrawInstanced((GLsizei)num_objects, object_offsets);
+			}
+			else if (object_culler.GpuDriven()) {
+				object_culled_renderable.DrawIndirect(object_culler.IndirectBuffer());
+			}
+			else {
+				GLintptr object_offsets[] = { 0 };
+				object_culled_renderable.DrawInstanced((GLsizei)object_culler.VisibleCount(), object_offsets);
+			}
+		});
+
+		opaque_passes.Add(0, programFire, texture_slots[SlotFire].texture, [&]() {
+			PROFILE_GPU_SCOPE("fireballs");
+			UseProgramMVP(programFire, MatrixFire);
+
+			// Sample the fireball's layer of the array on its unit
+			GLState().Uniform1i(TextureFireID, texture_slots[SlotFire].unit);
+			GLState().Uniform1i(LayerFireID, texture_slots[SlotFire].layer);
+
+			if (!gpu_culling) {
+				// One instanced draw per level of detail.
+				for (int level = 0; level < (int)fireball_lods.levels.size(); ++level) {
+					GLintptr fireball_offsets[] = {
+						fireball_position_offset + (GLintptr)(lod_first[level] * sizeof(vec3)),
+						fireball_coeff_offset + (GLintptr)(lod_first[level] * sizeof(float)) };
+					const MeshLodChain::Level& lod = fireball_lods.levels[level];
+					fireball_renderable.DrawInstanced((GLsizei)lod_count[level], fireball_offsets, lod.first_index, lod.index_count);
+				}
+			}
+			else if (fireball_culler.GpuDriven()) {
+				fireball_culled_renderable.DrawIndirect(fireball_culler.IndirectBuffer());
+			}
+			else {
+				GLintptr fireball_offsets[] = { 0, (GLintptr)GpuCuller::OutputExtraOffset };
+				fireball_culled_renderable.DrawInstanced((GLsizei)fireball_culler.VisibleCount(), fireball_offsets);
+			}
+		});
+
+		// Same program for the sky: only the unit and layer change between them
+		opaque_passes.Add(1, programID, texture_slots[SlotFloor].texture, [&]() {
+			PROFILE_GPU_SCOPE("floor");
+			UseProgramMVP(programID, MatrixID);
+			GLState().Uniform1i(TextureID, texture_slots[SlotFloor].unit);
+			GLState().Uniform1i(LayerID, texture_slots[SlotFloor].layer);
+			floor_renderable.Draw();
+		});
+
+		opaque_passes.Add(1, programID, texture_slots[SlotSky].texture, [&]() {
+			PROFILE_GPU_SCOPE("sky");
+			UseProgramMVP(programID, MatrixID);
+			GLState().Uniform1i(TextureID, texture_slots[SlotSky].unit);
+			GLState().Uniform1i(LayerID, texture_slots[SlotSky].layer);
+			sky_renderable.Draw();
+		});
+
+		opaque_passes.Submit();
+
+		// Nothing else reads this frame's slice of the stream buffer.
+		instance_stream.Fence();
+
+		hud.Print(".", 400, 300, 60);
+		std::string numberEnemies = std::to_string(snapshot.ObjectCount());
+		hud.Print("Num of enemies:", 10, 100, 14);
+		hud.Print(numberEnemies.c_str(), 80, 50, 30);
 
 		if (showInfoTime <= 5.0f) {
 			showInfoTime += deltaG;
-			printText2D("SHOOT-middle click", 0, 550, 20);
-			printText2D("FASTER-right click", 0, 500, 20);
-			printText2D("SLOWER-left click", 0, 450, 20);
+			hud.Print("SHOOT-middle click", 0, 550, 20);
+			hud.Print("FASTER-right click", 0, 500, 20);
+			hud.Print("SLOWER-left click", 0, 450, 20);
+		}
+#ifdef ENABLE_PROFILER
+		// Last refresh's averages, top right.
+		profiler.PrintOverlay(hud, 460, 580, 12);
+#endif
+		{
+			PROFILE_GPU_SCOPE("hud");
+			hud.Draw();
+		}
+
+		if (currentGlobal - reportTime >= 1.0) {
+			FrameStats::Report frames = frame_stats.Flush(currentGlobal);
+			std::cout << "frames: " << frames.frames << ", " << frames.mean_ms << " ms mean, "
+				<< frames.jitter_ms << " ms jitter, " << frames.max_ms << " ms max, "
+				<< frames.cpu_percent << "% cpu, " << 1.0 / snapshot.period << " sim steps/s\n";
+			std::cout << "input: " << (pipeline ? "pipelined" : "not pipelined") << ", " << latency_shots << " shots drawn";
+			if (latency_shots > 0) {
+				std::cout << ", " << latency_frames / latency_shots << " frames and " << latency_ms / latency_shots << " ms from click to screen on average";
+			}
+			std::cout << "\n";
+			std::cout << "instances: " << instance_stream.FrameBytes() + object_transforms.FrameBytes() + object_positions.FrameBytes()
+				<< " bytes uploaded, " << object_bytes << " of them for the enemies (" << object_transforms.TotalBytes() + object_positions.TotalBytes()
+				<< " patched into their resident copy so far), " << instance_stream.FrameStalls() << " stalls this frame ("
+				<< (instance_stream.Persistent() ? "persistent" : "unsynchronized") << " mapping)\n";
+			textures.Report(std::cout);
+			std::cout << "hud: one draw, " << hud.Tessellated() << " strings tessellated and " << hud.Uploads() << " uploads so far\n";
+			std::cout << "gl state: " << GLState().Issued() - frameStateIssued << " binds and program switches made, "
+				<< GLState().Skipped() - frameStateSkipped << " skipped as redundant this frame\n";
+			if (gpu_culling) {
+				// Reading the counts back waits for the cull passes; only done for this report.
+				num_objects = object_culler.VisibleCount();
+				num_fireballs = fireball_culler.VisibleCount();
+			}
+			std::cout << "culling" << (gpu_culling ? " (gpu)" : "") << ": objects " << num_objects << " visible, " << total_objects - num_objects << " culled; fireballs "
+				<< num_fireballs << " visible, " << total_fireballs - num_fireballs << " culled\n";
+			if (!gpu_culling && fireball_renderable.Ready()) {
+				size_t lod_triangles = 0;
+				std::cout << "lod: fireballs per level";
+				for (int level = 0; level < (int)fireball_lods.levels.size(); ++level) {
+					std::cout << (level == 0 ? " " : "/") << lod_count[level];
+					lod_triangles += lod_count[level] * fireball_lods.levels[level].index_count / 3;
+				}
+				std::cout << ", " << lod_triangles << " triangles (" << num_fireballs * fireball_lods.levels[0].index_count / 3 << " at full detail)\n";
+			}
+#ifdef COUNT_GL_CALLS
+			std::cout << "gl calls: " << GLCallCount() - frameGLCalls << " this frame\n";
+#endif
+			reportTime = currentGlobal;
 		}
 
 		// Swap buffers
-		glfwSwapBuffers(window);
+		headless.SwapBuffers();
 		glfwPollEvents();
+		for (const InputEvent& shot : snapshot.shots) {
+			++latency_shots;
+			latency_frames += (double)(frame_index - shot.frame);
+			latency_ms += MsSinceStart() - shot.sampled_ms;
+		}
+		++frame_index;
+		if (first_frame) {
+			std::cout << "first frame: " << MsSinceStart() << " ms after start\n";
+			first_frame = false;
+		}
+#ifdef ENABLE_PROFILER
+		profiler.EndFrame();
+#endif
+
+		if (!headless.Enabled()) {
+			PaceFrame(currentGlobal, glfwGetTime(), MinFramePeriod);
+		}
 
 	} // Check if the ESC key was pressed or the window was closed
 	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
-		glfwWindowShouldClose(window) == 0);
+		!headless.ShouldClose() && !snapshots.Front().replay_finished);
+	Jobs.Wait(sim_job);
+#ifdef ENABLE_PROFILER
+	if (profile_trace_path != NULL && profiler.WriteTrace(profile_trace_path)) {
+		std::cout << "profile: trace written to " << profile_trace_path << "\n";
+	}
+	profiler.Destroy();
+#endif
+
+	// The same line for a recording and its replay, to compare the two.
+	if (Recorder.IsOpen() || Replaying) {
+		std::cout << (Replaying ? "replay: " : "record: ") << SimSteps << " steps, "
+			<< ObjectsContainer.Count() << " objects and " << FireballsContainer.Count() << " fireballs left\n";
+	}
+	Recorder.Close(SimSteps);
+	assets.Stop();
 
 	// Cleanup VBO and shader
-	glDeleteBuffers(1, &object_vertexbuffer);
-	glDeleteBuffers(1, &object_quat_buffer);
-	glDeleteBuffers(1, &objects_position_buffer);
-	glDeleteBuffers(1, &object_colorbuffer);
-	glDeleteBuffers(1, &fireball_vertex_buffer);
-	glDeleteBuffers(1, &fireball_uvbuffer);
-	glDeleteBuffers(1, &fireball_position_buffer);
-	glDeleteBuffers(1, &fireball_normal_buffer);
-	glDeleteBuffers(1, &fireball_coeff_buffer);
-	glDeleteProgram(programObject);
-	glDeleteProgram(programFire);
-	glDeleteProgram(programID);
-	glDeleteProgram(programIDSky);
-
-	glDeleteTextures(1, &Texture);
-	glDeleteTextures(1, &TextureFloor);
-	glDeleteTextures(1, &TextureSky);
-
-	glDeleteVertexArrays(1, &VertexArrayID);
-
-	cleanupText2D();
+	object_renderable.Destroy();
+	if (gpu_culling) {
+		object_culled_renderable.Destroy();
+		fireball_culled_renderable.Destroy();
+		object_culler.Destroy();
+		fireball_culler.Destroy();
+		object_positions.Destroy();
+	}
+	object_transforms.Destroy();
+	instance_stream.Destroy();
+	fireball_renderable.Destroy();
+	floor_renderable.Destroy();
+	sky_renderable.Destroy();
+	shaders.Destroy();
+
+	textures.Destroy();
+	GLState().DeleteTextures(1, &TexturePlaceholder);
+
+	GLState().DeleteVertexArrays(1, &VertexArrayID);
+
+	hud.Destroy();
+	GLState().DeleteTextures(1, &TextureFont);
+	Jobs.Stop();
 	// Close OpenGL window and terminate GLFW
-	glfwTerminate();
+	headless.Terminate();
 
-	return 0;
+	return assets_failed ? -1 : 0;
 }
@@ -0,0 +1,373 @@
+#ifndef JOB_SYSTEM_HPP
+#define JOB_SYSTEM_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the jobs of a batch that have not finished; JobSystem::Wait() on it.
+struct JobGroup {
+	std::atomic<int> pending;
+
+	JobGroup() : pending(0) {}
+	bool Done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+// A unit of work: call(this). Whoever runs it counts its group down after.
+struct JobTask {
+	void (*call)(JobTask* task);
+	JobGroup* group;
+	const void* context;
+	size_t begin;
+	size_t end;
+};
+
+// Chase-Lev work-stealing deque of a fixed size (Le et al., "Correct and
+// Efficient Work-Stealing for Weak Memory Models"). Only the owning thread
+// pushes and pops, at the bottom; any thread steals from the top, so the
+// owner works newest first and thieves take the oldest (largest) work.
+class WorkDeque {
+public:
+	static const int64_t Capacity = 4096;
+
+	WorkDeque() : top(0), bottom(0) {
+		for (std::atomic<JobTask*>& slot : slots) {
+			slot.store(NULL, std::memory_order_relaxed);
+		}
+	}
+
+	// Owner only; false when full, and then the caller runs task itself.
+	bool Push(JobTask* task) {
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		if (b - t >= Capacity) {
+			return false;
+		}
+		slots[b & (Capacity - 1)].store(task, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Owner only.
+	JobTask* Pop() {
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+		if (t > b) {
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return NULL;
+		}
+		JobTask* task = slots[b & (Capacity - 1)].load(std::memory_order_relaxed);
+		if (t == b) {
+			// The last one: race the thieves for it.
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				task = NULL;
+			}
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return task;
+	}
+
+	// Any thread. NULL when empty or another thread got there first.
+	JobTask* Steal() {
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b) {
+			return NULL;
+		}
+		JobTask* task = slots[t & (Capacity - 1)].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return NULL;
+		}
+		return task;
+	}
+
+private:
+	// Padded apart, so the owner's bottom and the thieves' top don't share a line.
+	std::atomic<int64_t> top;
+	char top_padding[64 - sizeof(int64_t)];
+	std::atomic<int64_t> bottom;
+	char bottom_padding[64 - sizeof(int64_t)];
+	std::atomic<JobTask*> slots[Capacity];
+};
+
+// Worker threads plus the thread that calls Start() (thread 0), each with a
+// WorkDeque. A thread pushes what it spawns onto its own deque and, out of
+// work, steals from the others; idle workers sleep until something is pushed.
+// Results go back through memory the job owns (its slice of an output
+// array, its slot in a vector of per-chunk results), never through a lock.
+//
+// Run() jobs go to a queue of their own that only workers take from, and
+// Wait() on their group: a thread waiting on something else (e.g. its own
+// ParallelFor) never picks up a long Run() job in the middle of it.
+//
+// With no workers, every job runs inline where it is submitted, as do
+// ParallelFor's on threads that are not part of the system.
+//
+//     jobs.ParallelFor(count, grain, [&](size_t begin, size_t end) { ... });
+//
+//     JobGroup group;
+//     jobs.Run(group, [&]() { ... });
+//     ... // meanwhile, on this thread
+//     jobs.Wait(group);
+class JobSystem {
+public:
+	typedef std::function<void()> Job;
+
+	JobSystem() : queued(0), sleepers(0), stopping(false), steals(0), executed(0) {}
+	~JobSystem() { Stop(); }
+
+	// The calling thread becomes thread 0.
+	void Start(int workers) {
+		deques.clear();
+		for (int i = 0; i <= workers; ++i) {
+			deques.emplace_back(new WorkDeque());
+		}
+		stopping = false;
+		Local().system = this;
+		Local().index = 0;
+		for (int i = 1; i <= workers; ++i) {
+			threads.emplace_back(&JobSystem::Work, this, i);
+		}
+	}
+
+	// Joins the workers. Everything submitted must have been waited for.
+	void Stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_ready.notify_all();
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		threads.clear();
+		if (Local().system == this) {
+			Local().system = NULL;
+		}
+	}
+
+	int Workers() const { return (int)threads.size(); }
+	// Jobs taken from another thread's deque, and jobs run from a deque, so far.
+	unsigned long Steals() const { return steals.load(std::memory_order_relaxed); }
+	unsigned long Executed() const { return executed.load(std::memory_order_relaxed); }
+
+	// Queues job for the first idle worker, or for whoever waits on group.
+	void Run(JobGroup& group, Job job) {
+		HeapTask* task = new HeapTask();
+		task->call = &HeapTask::Call;
+		task->group = &group;
+		task->job = job;
+		group.pending.fetch_add(1, std::memory_order_relaxed);
+		if (threads.empty()) {
+			Execute(task);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(run_mutex);
+			run_queue.push_back(task);
+		}
+		Notify();
+	}
+
+	// Runs jobs, this thread's first, until group is done. Of the Run() jobs
+	// no worker has taken yet, only group's own.
+	void Wait(JobGroup& group) {
+		int index = ThreadIndex();
+		while (!group.Done()) {
+			JobTask* task = index >= 0 ? FindWork(index) : NULL;
+			if (task == NULL) {
+				task = TakeRun(&group);
+			}
+			if (task != NULL) {
+				Execute(task);
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// fn(begin, end) over [0, count) in chunks of grain, chunk k being
+	// [k * grain, (k + 1) * grain); returns once all of them ran. This thread
+	// runs the first chunk and then helps with the rest. A single chunk runs
+	// inline.
+	template <typename Fn>
+	void ParallelFor(size_t count, size_t grain, const Fn& fn) {
+		size_t chunks = ChunkCount(count, grain);
+		int index = ThreadIndex();
+		if (chunks <= 1 || threads.empty() || index < 0) {
+			for (size_t begin = 0; begin < count; begin += grain) {
+				fn(begin, std::min(begin + grain, count));
+			}
+			return;
+		}
+		JobGroup group;
+		std::vector<JobTask> tasks(chunks - 1);
+		group.pending.store((int)tasks.size(), std::memory_order_relaxed);
+		// Last chunk first, so thieves take the far end and this thread works up from the start.
+		for (size_t k = chunks - 1; k > 0; --k) {
+			JobTask& task = tasks[k - 1];
+			task.call = &CallRange<Fn>;
+			task.group = &group;
+			task.context = &fn;
+			task.begin = k * grain;
+			task.end = std::min(task.begin + grain, count);
+			Submit(&task);
+		}
+		fn(0, std::min(grain, count));
+		Wait(group);
+	}
+
+	static size_t ChunkCount(size_t count, size_t grain) {
+		return (count + grain - 1) / grain;
+	}
+
+private:
+	struct HeapTask : JobTask {
+		Job job;
+		static void Call(JobTask* task) {
+			HeapTask* self = static_cast<HeapTask*>(task);
+			self->job();
+			delete self;
+		}
+	};
+
+	template <typename Fn>
+	static void CallRange(JobTask* task) {
+		(*static_cast<const Fn*>(task->context))(task->begin, task->end);
+	}
+
+	struct ThreadSlot {
+		JobSystem* system;
+		int index;
+	};
+
+	static ThreadSlot& Local() {
+		static thread_local ThreadSlot slot = { NULL, -1 };
+		return slot;
+	}
+
+	// This thread's deque, or -1 if it isn't one of ours.
+	int ThreadIndex() const {
+		return Local().system == this ? Local().index : -1;
+	}
+
+	void Submit(JobTask* task) {
+		int index = ThreadIndex();
+		if (index < 0 || threads.empty() || !deques[index]->Push(task)) {
+			Execute(task);
+			return;
+		}
+		Notify();
+	}
+
+	void Notify() {
+		queued.fetch_add(1);
+		if (sleepers.load() > 0) {
+			std::lock_guard<std::mutex> lock(mutex);
+			work_ready.notify_one();
+		}
+	}
+
+	// The oldest Run() job of group, or of any group if group is NULL.
+	JobTask* TakeRun(const JobGroup* group) {
+		std::lock_guard<std::mutex> lock(run_mutex);
+		for (std::deque<JobTask*>::iterator it = run_queue.begin(); it != run_queue.end(); ++it) {
+			if (group == NULL || (*it)->group == group) {
+				JobTask* task = *it;
+				run_queue.erase(it);
+				queued.fetch_sub(1);
+				return task;
+			}
+		}
+		return NULL;
+	}
+
+	void Execute(JobTask* task) {
+		// The task may be gone once call returns (HeapTask) or once the group hits zero (ParallelFor's).
+		JobGroup* group = task->group;
+		task->call(task);
+		executed.fetch_add(1, std::memory_order_relaxed);
+		group->pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	JobTask* FindWork(int index) {
+		JobTask* task = deques[index]->Pop();
+		for (size_t i = 1; task == NULL && i < deques.size(); ++i) {
+			task = deques[(index + i) % deques.size()]->Steal();
+			if (task != NULL) {
+				steals.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		if (task != NULL) {
+			queued.fetch_sub(1);
+		}
+		return task;
+	}
+
+	void Work(int index) {
+		Local().system = this;
+		Local().index = index;
+		for (;;) {
+			JobTask* task = NULL;
+			// Spin a little before sleeping; a frame's jobs come in bursts.
+			for (int spin = 0; spin < 64 && task == NULL; ++spin) {
+				task = FindWork(index);
+				if (task == NULL) {
+					task = TakeRun(NULL);
+				}
+				if (task == NULL) {
+					std::this_thread::yield();
+				}
+			}
+			if (task != NULL) {
+				Execute(task);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			sleepers.fetch_add(1);
+			work_ready.wait(lock, [this] { return stopping || queued.load() > 0; });
+			sleepers.fetch_sub(1);
+			if (stopping) {
+				return;
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<WorkDeque> > deques; // [0] is the thread that called Start()
+	std::vector<std::thread> threads;
+	std::atomic<int> queued;   // pushed or Run() and not yet taken
+	std::atomic<int> sleepers;
+	bool stopping;
+	std::mutex mutex;
+	std::condition_variable work_ready;
+	std::mutex run_mutex;
+	std::deque<JobTask*> run_queue; // Run() jobs, oldest first
+	std::atomic<unsigned long> steals;
+	std::atomic<unsigned long> executed;
+};
+
+// jobs->ParallelFor, or a plain loop over the same chunks without a job system.
+template <typename Fn>
+void ParallelFor(JobSystem* jobs, size_t count, size_t grain, const Fn& fn) {
+	if (jobs != NULL) {
+		jobs->ParallelFor(count, grain, fn);
+		return;
+	}
+	for (size_t begin = 0; begin < count; begin += grain) {
+		fn(begin, std::min(begin + grain, count));
+	}
+}
+
+#endif
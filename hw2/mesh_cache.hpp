@@ -0,0 +1,195 @@
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glm/glm.hpp>
+
+#include <common/objloader.hpp>
+
+#include "mapped_file.hpp"
+#include "mesh_optimizer.hpp"
+
+// Interleaved vertex, as stored in the cache file and in the vertex buffer.
+struct MeshVertex {
+	glm::vec3 pos;
+	glm::vec2 uv;
+	glm::vec3 normal;
+};
+static_assert(sizeof(MeshVertex) == 8 * sizeof(float), "MeshVertex must be tightly packed");
+
+// Binary mesh file, written next to the OBJ as <name>.obj.mesh:
+//     MeshFileHeader
+//     MeshVertex vertices[vertex_count]
+//     uint32_t indices[index_count]      (triangle list; none: the vertices are one)
+// The file is only used when source_size and source_mtime still match the OBJ.
+struct MeshFileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	float bounds_min[3];
+	float bounds_max[3];
+	uint64_t source_size;
+	int64_t source_mtime;
+};
+
+const char MeshFileMagic[4] = { 'H', 'W', 'M', 'B' };
+const uint32_t MeshFileVersion = 2;
+
+// A loaded mesh. The arrays point either into the mapped cache file or into
+// the vectors below when the mesh was just parsed from the OBJ.
+struct MeshData {
+	const MeshVertex* vertices;
+	uint32_t vertex_count;
+	const uint32_t* indices;
+	uint32_t index_count;
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_max;
+	bool from_cache;
+
+	MappedFile file;
+	std::vector<MeshVertex> vertex_storage;
+	std::vector<uint32_t> index_storage;
+
+	MeshData() : vertices(nullptr), vertex_count(0), indices(nullptr), index_count(0), from_cache(false) {}
+
+	// Releases the mapping or the parsed arrays once they are uploaded.
+	void Clear() {
+		file.Close();
+		std::vector<MeshVertex>().swap(vertex_storage);
+		std::vector<uint32_t>().swap(index_storage);
+		vertices = nullptr;
+		indices = nullptr;
+	}
+
+	// Number of vertices the draw call consumes.
+	uint32_t DrawCount() const { return index_count > 0 ? index_count : vertex_count; }
+};
+
+inline bool StatSource(const char* path, uint64_t& size, int64_t& mtime) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return false;
+	}
+	size = (uint64_t)st.st_size;
+	mtime = (int64_t)st.st_mtime;
+	return true;
+}
+
+// Maps the cache file and checks it against the source; false if it is missing or stale.
+inline bool LoadMeshCache(const char* cache_path, uint64_t source_size, int64_t source_mtime, MeshData& mesh) {
+	if (!mesh.file.Open(cache_path)) {
+		return false;
+	}
+	const MeshFileHeader* header = (const MeshFileHeader*)mesh.file.Data();
+	bool valid = mesh.file.Size() >= sizeof(MeshFileHeader) &&
+		memcmp(header->magic, MeshFileMagic, 4) == 0 &&
+		header->version == MeshFileVersion &&
+		header->source_size == source_size &&
+		header->source_mtime == source_mtime &&
+		mesh.file.Size() == sizeof(MeshFileHeader) + header->vertex_count * sizeof(MeshVertex) + header->index_count * sizeof(uint32_t);
+	if (!valid) {
+		mesh.file.Close();
+		return false;
+	}
+	mesh.vertices = (const MeshVertex*)(mesh.file.Data() + sizeof(MeshFileHeader));
+	mesh.vertex_count = header->vertex_count;
+	mesh.indices = header->index_count > 0 ? (const uint32_t*)(mesh.vertices + header->vertex_count) : nullptr;
+	mesh.index_count = header->index_count;
+	mesh.bounds_min = glm::vec3(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]);
+	mesh.bounds_max = glm::vec3(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]);
+	mesh.from_cache = true;
+	return true;
+}
+
+inline bool WriteMeshCache(const char* cache_path, uint64_t source_size, int64_t source_mtime, const MeshData& mesh) {
+	MeshFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MeshFileMagic, 4);
+	header.version = MeshFileVersion;
+	header.vertex_count = mesh.vertex_count;
+	header.index_count = mesh.index_count;
+	for (int i = 0; i < 3; ++i) {
+		header.bounds_min[i] = mesh.bounds_min[i];
+		header.bounds_max[i] = mesh.bounds_max[i];
+	}
+	header.source_size = source_size;
+	header.source_mtime = source_mtime;
+
+	FILE* file = fopen(cache_path, "wb");
+	if (file == NULL) {
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(mesh.vertices, sizeof(MeshVertex), mesh.vertex_count, file) == mesh.vertex_count;
+	ok = ok && (mesh.index_count == 0 || fwrite(mesh.indices, sizeof(uint32_t), mesh.index_count, file) == mesh.index_count);
+	ok = fclose(file) == 0 && ok;
+	if (!ok) {
+		remove(cache_path);
+	}
+	return ok;
+}
+
+// Parses the OBJ with the tutorial loader, which expands every face into its
+// own three vertices, then welds the shared ones and orders the triangles and
+// vertices for the post-transform cache.
+inline bool LoadMeshFromObj(const char* path, MeshData& mesh) {
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	if (!loadOBJ(path, vertices, uvs, normals) || vertices.empty()) {
+		return false;
+	}
+	std::vector<MeshVertex> soup(vertices.size());
+	mesh.bounds_min = mesh.bounds_max = vertices[0];
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		MeshVertex& v = soup[i];
+		v.pos = vertices[i];
+		v.uv = i < uvs.size() ? uvs[i] : glm::vec2(0.0f);
+		v.normal = i < normals.size() ? normals[i] : glm::vec3(0.0f);
+		mesh.bounds_min = glm::min(mesh.bounds_min, v.pos);
+		mesh.bounds_max = glm::max(mesh.bounds_max, v.pos);
+	}
+	WeldVertices(soup.data(), (uint32_t)soup.size(), mesh.vertex_storage, mesh.index_storage);
+	OptimizeVertexCache(mesh.index_storage, (uint32_t)mesh.vertex_storage.size());
+	OptimizeVertexFetch(mesh.vertex_storage, mesh.index_storage);
+
+	mesh.vertices = mesh.vertex_storage.data();
+	mesh.vertex_count = (uint32_t)mesh.vertex_storage.size();
+	mesh.indices = mesh.index_storage.data();
+	mesh.index_count = (uint32_t)mesh.index_storage.size();
+	mesh.from_cache = false;
+	return true;
+}
+
+// Loads path from its binary cache if that is up to date, otherwise parses the
+// OBJ and (re)writes the cache. With use_cache false the OBJ is always parsed
+// and no cache is touched.
+inline bool LoadMesh(const char* path, MeshData& mesh, bool use_cache = true) {
+	uint64_t source_size = 0;
+	int64_t source_mtime = 0;
+	if (!StatSource(path, source_size, source_mtime)) {
+		fprintf(stderr, "%s could not be opened.\n", path);
+		return false;
+	}
+	std::string cache_path = std::string(path) + ".mesh";
+	if (use_cache && LoadMeshCache(cache_path.c_str(), source_size, source_mtime, mesh)) {
+		return true;
+	}
+	if (!LoadMeshFromObj(path, mesh)) {
+		return false;
+	}
+	if (use_cache && !WriteMeshCache(cache_path.c_str(), source_size, source_mtime, mesh)) {
+		fprintf(stderr, "Could not write mesh cache %s\n", cache_path.c_str());
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef MESH_OPTIMIZER_HPP
+#define MESH_OPTIMIZER_HPP
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+// Post-transform cache size the reordering and the ACMR figure assume.
+const uint32_t VertexCacheSize = 16;
+
+// FNV-1a over the bytes of a vertex; Vertex must have no padding.
+template <typename Vertex>
+struct VertexBytesHash {
+	size_t operator()(const Vertex& v) const {
+		const unsigned char* bytes = (const unsigned char*)&v;
+		size_t h = 2166136261u;
+		for (size_t i = 0; i < sizeof(Vertex); ++i) {
+			h = (h ^ bytes[i]) * 16777619u;
+		}
+		return h;
+	}
+};
+
+template <typename Vertex>
+struct VertexBytesEqual {
+	bool operator()(const Vertex& a, const Vertex& b) const {
+		return memcmp(&a, &b, sizeof(Vertex)) == 0;
+	}
+};
+
+// Turns a triangle list into unique vertices plus indices. Only bit-identical
+// position/uv/normal tuples are merged, so seams in uv or normal stay split.
+template <typename Vertex>
+void WeldVertices(const Vertex* soup, uint32_t count, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+	std::unordered_map<Vertex, uint32_t, VertexBytesHash<Vertex>, VertexBytesEqual<Vertex> > unique;
+	unique.reserve(count);
+	vertices.clear();
+	indices.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		auto inserted = unique.insert(std::make_pair(soup[i], (uint32_t)vertices.size()));
+		if (inserted.second) {
+			vertices.push_back(soup[i]);
+		}
+		indices[i] = inserted.first->second;
+	}
+}
+
+// Average cache miss ratio: vertex shader invocations per triangle with a FIFO
+// post-transform cache of cache_size entries. 3.0 is a triangle soup; around
+// 0.6-0.7 is as good as a regular mesh gets.
+inline float ComputeACMR(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size = VertexCacheSize) {
+	if (index_count < 3) {
+		return 0.0f;
+	}
+	// A vertex is cached if it was last loaded less than cache_size misses ago.
+	std::vector<uint32_t> loaded_at(vertex_count, 0);
+	uint32_t misses = 0;
+	for (uint32_t i = 0; i < index_count; ++i) {
+		uint32_t v = indices[i];
+		if (loaded_at[v] == 0 || misses - loaded_at[v] >= cache_size) {
+			++misses;
+			loaded_at[v] = misses;
+		}
+	}
+	return (float)misses / (index_count / 3);
+}
+
+// Reorders triangles for the post-transform cache with Tipsify (Sander, Nehab
+// and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw"): fan around a vertex, then move on to the neighbour that is
+// still cached and has triangles left, falling back to recent dead ends.
+inline void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertex_count, uint32_t cache_size = VertexCacheSize) {
+	uint32_t triangle_count = (uint32_t)indices.size() / 3;
+	if (triangle_count == 0 || vertex_count == 0) {
+		return;
+	}
+
+	// Triangles around each vertex, as offsets into one array.
+	std::vector<uint32_t> live(vertex_count, 0);
+	for (uint32_t i = 0; i < triangle_count * 3; ++i) {
+		++live[indices[i]];
+	}
+	std::vector<uint32_t> offsets(vertex_count + 1, 0);
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		offsets[v + 1] = offsets[v] + live[v];
+	}
+	std::vector<uint32_t> adjacency(offsets[vertex_count]);
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		for (int k = 0; k < 3; ++k) {
+			adjacency[fill[indices[t * 3 + k]]++] = t;
+		}
+	}
+
+	std::vector<uint32_t> cache_time(vertex_count, 0);
+	std::vector<uint8_t> emitted(triangle_count, 0);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(triangle_count * 3);
+
+	uint32_t time = cache_size + 1;
+	uint32_t cursor = 0;
+	int64_t fan = 0;
+	while (fan >= 0) {
+		candidates.clear();
+		for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; ++a) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = indices[t * 3 + k];
+				output.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (time - cache_time[v] > cache_size) {
+					cache_time[v] = time;
+					++time;
+				}
+			}
+			emitted[t] = 1;
+		}
+
+		// Next fan: the candidate that will still be cached after its own
+		// triangles are emitted, oldest in the cache first.
+		fan = -1;
+		int64_t best = -1;
+		for (uint32_t v : candidates) {
+			if (live[v] == 0) {
+				continue;
+			}
+			int64_t priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= cache_size) {
+				priority = time - cache_time[v];
+			}
+			if (priority > best) {
+				best = priority;
+				fan = v;
+			}
+		}
+		if (fan >= 0) {
+			continue;
+		}
+		while (!dead_end.empty()) {
+			uint32_t v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] > 0) {
+				fan = v;
+				break;
+			}
+		}
+		for (; fan < 0 && cursor < vertex_count; ++cursor) {
+			if (live[cursor] > 0) {
+				fan = cursor;
+			}
+		}
+	}
+	indices.swap(output);
+}
+
+// Renumbers vertices in the order the indices first use them, so vertex fetch
+// walks the buffer forwards.
+template <typename Vertex>
+void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+	const uint32_t Unused = 0xffffffffu;
+	std::vector<uint32_t> remap(vertices.size(), Unused);
+	std::vector<Vertex> ordered;
+	ordered.reserve(vertices.size());
+	for (uint32_t& i : indices) {
+		if (remap[i] == Unused) {
+			remap[i] = (uint32_t)ordered.size();
+			ordered.push_back(vertices[i]);
+		}
+		i = remap[i];
+	}
+	vertices.swap(ordered);
+}
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef MESH_SIMPLIFIER_HPP
+#define MESH_SIMPLIFIER_HPP
+
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "mesh_optimizer.hpp"
+
+// Symmetric 4x4 error quadric of a set of planes (Garland and Heckbert,
+// "Surface Simplification Using Quadric Error Metrics"): Evaluate(p) is the
+// sum of squared distances from p to the planes.
+struct Quadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+	Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) {}
+
+	// The plane ax + by + cz + d = 0, (a, b, c) unit length.
+	static Quadric Plane(double a, double b, double c, double d) {
+		Quadric q;
+		q.a2 = a * a; q.ab = a * b; q.ac = a * c; q.ad = a * d;
+		q.b2 = b * b; q.bc = b * c; q.bd = b * d;
+		q.c2 = c * c; q.cd = c * d;
+		q.d2 = d * d;
+		return q;
+	}
+
+	void operator+=(const Quadric& q) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+
+	double Evaluate(const glm::vec3& p) const {
+		double x = p.x, y = p.y, z = p.z;
+		double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+			+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+			+ c2 * z * z + 2 * cd * z + d2;
+		return e > 0.0 ? e : 0.0;
+	}
+};
+
+// Simplifies an indexed triangle list to at most target_index_count indices,
+// or as close as it gets, by collapsing edges cheapest quadric error first.
+//
+// Topology is by position, so the copies of a vertex that differ only in
+// normal (flat shading) collapse together. A collapse moves every copy of one
+// position onto a neighbouring position, each to the copy there with the
+// nearest uv and normal (half-edge collapse): the result indexes the same
+// vertices, so every level of detail can share one vertex buffer. Positions
+// on a uv seam or an open border never move, and a collapse that would flip
+// a triangle is skipped. Vertex needs pos, uv and normal.
+//
+// Returns the largest quadric error of any collapse made (the root of a sum
+// of squared distances, so an upper bound on how far the surface moved). The
+// output is reordered for the vertex cache.
+template <typename Vertex>
+float SimplifyMesh(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+	uint32_t target_index_count, std::vector<uint32_t>& out) {
+	uint32_t triangle_count = index_count / 3;
+	std::vector<uint32_t> tri(indices, indices + triangle_count * 3);
+
+	// corner[v] is the first vertex at v's position and stands for all of them.
+	std::vector<uint32_t> corner(vertex_count);
+	std::vector<std::vector<uint32_t> > copies(vertex_count);
+	{
+		std::unordered_map<glm::vec3, uint32_t, VertexBytesHash<glm::vec3>, VertexBytesEqual<glm::vec3> > first;
+		for (uint32_t v = 0; v < vertex_count; ++v) {
+			corner[v] = first.insert(std::make_pair(vertices[v].pos, v)).first->second;
+			copies[corner[v]].push_back(v);
+		}
+	}
+	std::vector<uint8_t> locked(vertex_count, 0);
+	for (uint32_t c = 0; c < vertex_count; ++c) {
+		for (uint32_t v : copies[c]) {
+			locked[c] = locked[c] || vertices[v].uv != vertices[c].uv;
+		}
+	}
+	// An edge used by one triangle only is on a border.
+	{
+		std::unordered_map<uint64_t, int> edge_use;
+		for (int pass = 0; pass < 2; ++pass) {
+			for (uint32_t t = 0; t < triangle_count; ++t) {
+				for (int k = 0; k < 3; ++k) {
+					uint64_t a = corner[tri[t * 3 + k]], b = corner[tri[t * 3 + (k + 1) % 3]];
+					uint64_t edge = a < b ? (a << 32) | b : (b << 32) | a;
+					if (pass == 0) {
+						++edge_use[edge];
+					}
+					else if (edge_use[edge] == 1) {
+						locked[a] = locked[b] = 1;
+					}
+				}
+			}
+		}
+	}
+
+	std::vector<Quadric> quadric(vertex_count);
+	std::vector<std::vector<uint32_t> > around(vertex_count); // triangles, by corner
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		glm::vec3 p0 = vertices[tri[t * 3]].pos, p1 = vertices[tri[t * 3 + 1]].pos, p2 = vertices[tri[t * 3 + 2]].pos;
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(n);
+		if (length > 0.0f) {
+			n = n * (1.0f / length);
+			Quadric q = Quadric::Plane(n.x, n.y, n.z, -glm::dot(n, p0));
+			for (int k = 0; k < 3; ++k) {
+				quadric[corner[tri[t * 3 + k]]] += q;
+			}
+		}
+		for (int k = 0; k < 3; ++k) {
+			around[corner[tri[t * 3 + k]]].push_back(t);
+		}
+	}
+
+	struct Collapse {
+		double error;
+		uint32_t from, to; // corners
+		uint32_t version;  // of from when queued
+		bool operator<(const Collapse& other) const { return error > other.error; }
+	};
+	std::priority_queue<Collapse> queue;
+	std::vector<uint32_t> version(vertex_count, 0);
+	std::vector<uint8_t> dead_triangle(triangle_count, 0);
+
+	auto has_corner = [&](uint32_t t, uint32_t c) {
+		return corner[tri[t * 3]] == c || corner[tri[t * 3 + 1]] == c || corner[tri[t * 3 + 2]] == c;
+	};
+	auto queue_corner = [&](uint32_t from) {
+		if (locked[from]) {
+			return;
+		}
+		for (uint32_t t : around[from]) {
+			for (int k = 0; k < 3 && !dead_triangle[t]; ++k) {
+				uint32_t to = corner[tri[t * 3 + k]];
+				if (to != from) {
+					Quadric q = quadric[from];
+					q += quadric[to];
+					queue.push(Collapse{ q.Evaluate(vertices[to].pos), from, to, version[from] });
+				}
+			}
+		}
+	};
+	// Moving from onto to must not turn any remaining triangle around from over.
+	auto flips = [&](uint32_t from, uint32_t to) {
+		for (uint32_t t : around[from]) {
+			if (dead_triangle[t] || has_corner(t, to)) {
+				continue;
+			}
+			glm::vec3 p[3];
+			for (int k = 0; k < 3; ++k) {
+				p[k] = vertices[tri[t * 3 + k]].pos;
+			}
+			glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+			for (int k = 0; k < 3; ++k) {
+				if (corner[tri[t * 3 + k]] == from) {
+					p[k] = vertices[to].pos;
+				}
+			}
+			glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+			if (glm::dot(before, after) <= 0.0f) {
+				return true;
+			}
+		}
+		return false;
+	};
+	// The copy at corner to that looks most like vertex v.
+	auto nearest_copy = [&](uint32_t v, uint32_t to) {
+		uint32_t best = to;
+		float best_distance = 1e30f;
+		for (uint32_t candidate : copies[to]) {
+			glm::vec2 duv = vertices[candidate].uv - vertices[v].uv;
+			glm::vec3 dn = vertices[candidate].normal - vertices[v].normal;
+			float d = glm::dot(duv, duv) + glm::dot(dn, dn);
+			if (d < best_distance) {
+				best_distance = d;
+				best = candidate;
+			}
+		}
+		return best;
+	};
+
+	for (uint32_t c = 0; c < vertex_count; ++c) {
+		if (corner[c] == c) {
+			queue_corner(c);
+		}
+	}
+
+	uint32_t alive = triangle_count;
+	double max_error = 0.0;
+	std::vector<uint32_t> neighbours;
+	while (alive * 3 > target_index_count && !queue.empty()) {
+		Collapse c = queue.top();
+		queue.pop();
+		if (c.version != version[c.from] || locked[c.from] || flips(c.from, c.to)) {
+			continue;
+		}
+		for (uint32_t t : around[c.from]) {
+			if (dead_triangle[t]) {
+				continue;
+			}
+			if (has_corner(t, c.to)) {
+				dead_triangle[t] = 1;
+				--alive;
+				continue;
+			}
+			for (int k = 0; k < 3; ++k) {
+				uint32_t& v = tri[t * 3 + k];
+				if (corner[v] == c.from) {
+					v = nearest_copy(v, c.to);
+				}
+			}
+			around[c.to].push_back(t);
+		}
+		around[c.from].clear();
+		quadric[c.to] += quadric[c.from];
+		locked[c.from] = 1; // gone
+		max_error = std::max(max_error, c.error);
+
+		// Every collapse out of to and its neighbours now costs something else.
+		neighbours.assign(1, c.to);
+		for (uint32_t t : around[c.to]) {
+			for (int k = 0; k < 3 && !dead_triangle[t]; ++k) {
+				neighbours.push_back(corner[tri[t * 3 + k]]);
+			}
+		}
+		std::sort(neighbours.begin(), neighbours.end());
+		neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		for (uint32_t n : neighbours) {
+			++version[n];
+			queue_corner(n);
+		}
+	}
+
+	out.clear();
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		if (!dead_triangle[t]) {
+			out.insert(out.end(), tri.begin() + t * 3, tri.begin() + t * 3 + 3);
+		}
+	}
+	OptimizeVertexCache(out, vertex_count);
+	return (float)std::sqrt(max_error);
+}
+
+// Distance from p to the closest point of triangle abc (Ericson, "Real-Time
+// Collision Detection", 5.1.5).
+inline float PointTriangleDistance(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+	glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		return glm::length(ap);
+	}
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3) {
+		return glm::length(bp);
+	}
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		return glm::length(p - (a + ab * (d1 / (d1 - d3))));
+	}
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6) {
+		return glm::length(cp);
+	}
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		return glm::length(p - (a + ac * (d2 / (d2 - d6))));
+	}
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+		return glm::length(p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))));
+	}
+	float denom = 1.0f / (va + vb + vc);
+	return glm::length(p - (a + ab * (vb * denom) + ac * (vc * denom)));
+}
+
+// How far a simplified level is from the original: the largest distance from
+// a vertex of the original to the nearest triangle of the level. Brute force,
+// vertices times triangles, which is fine for small meshes at load.
+template <typename Vertex>
+float MeshDeviation(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count) {
+	float deviation = 0.0f;
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		float nearest = 1e30f;
+		for (uint32_t i = 0; i + 2 < index_count && nearest > deviation; i += 3) {
+			nearest = std::min(nearest, PointTriangleDistance(vertices[v].pos,
+				vertices[indices[i]].pos, vertices[indices[i + 1]].pos, vertices[indices[i + 2]].pos));
+		}
+		deviation = std::max(deviation, nearest);
+	}
+	return deviation;
+}
+
+// Levels of detail of one mesh, every level indexing the same vertices.
+// indices holds the levels back to back, finest (the mesh itself) first.
+struct MeshLodChain {
+	struct Level {
+		uint32_t first_index;
+		uint32_t index_count;
+		float error; // MeshDeviation from the finest level, model units
+	};
+
+	std::vector<uint32_t> indices;
+	std::vector<Level> levels;
+
+	// Halves the triangle count per level, up to max_levels, and stops early
+	// once a level removes less than a tenth of the triangles.
+	template <typename Vertex>
+	void Build(const Vertex* vertices, uint32_t vertex_count, const uint32_t* mesh_indices, uint32_t index_count, int max_levels) {
+		indices.assign(mesh_indices, mesh_indices + index_count);
+		levels.assign(1, Level{ 0, index_count, 0.0f });
+		std::vector<uint32_t> level;
+		while ((int)levels.size() < max_levels) {
+			uint32_t previous = levels.back().index_count;
+			SimplifyMesh(vertices, vertex_count, mesh_indices, index_count, previous / 2 / 3 * 3, level);
+			if (level.size() * 10 > previous * 9) {
+				break;
+			}
+			float error = MeshDeviation(vertices, vertex_count, level.data(), (uint32_t)level.size());
+			levels.push_back(Level{ (uint32_t)indices.size(), (uint32_t)level.size(), error });
+			indices.insert(indices.end(), level.begin(), level.end());
+		}
+	}
+
+	// The coarsest level whose error is under max_error (same units).
+	int Select(float max_error) const {
+		int level = 0;
+		while (level + 1 < (int)levels.size() && levels[level + 1].error <= max_error) {
+			++level;
+		}
+		return level;
+	}
+};
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+// Hierarchical frame profiler, compiled in with -DENABLE_PROFILER:
+//
+//     PROFILE_SCOPE("collide");        // CPU time until the end of the block
+//     PROFILE_GPU_SCOPE("fireballs");  // the same, plus the GPU time of the GL calls in it
+//
+// Without ENABLE_PROFILER both macros are empty statements and nothing below
+// is compiled, so instrumented code costs nothing.
+//
+// CPU scopes may be opened on any thread and nest per thread. GPU scopes
+// are for the GL thread only and are timed with a pair of GL_TIMESTAMP
+// queries each (glQueryCounter), which unlike GL_TIME_ELAPSED nest inside
+// FrameReport's frame query. A frame's queries are read back at the end of
+// the next frame, when the GPU is done with them.
+//
+// Per frame, on the GL thread:
+//     profiler.BeginFrame();  ... scopes ...  profiler.EndFrame();
+// which is itself the "frame" scope; PrintOverlay() puts the averages of the
+// last RefreshFrames frames on the HUD, and WriteTrace() saves every scope of
+// the run as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+
+#ifdef ENABLE_PROFILER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "text_batch.hpp"
+
+class Profiler {
+public:
+	// Scopes of a frame measured on the GPU, and events kept per thread for the trace.
+	static const int MaxGpuScopes = 32;
+	static const size_t MaxTraceEvents = 1 << 20;
+	static const int RefreshFrames = 30;
+	static const int GpuThread = 1000; // the GPU's row in the trace
+
+	static Profiler& Get() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	// Needs the context.
+	void Create() {
+		for (GpuFrame& frame : gpu_frames) {
+			glGenQueries(MaxGpuScopes * 2, frame.queries);
+			frame.count = 0;
+			frame.pending = false;
+		}
+		// GPU timestamps count from their own origin; note where it is on our clock.
+		GLint64 gpu_now = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+		gpu_offset_us = NowUs() - gpu_now / 1000.0;
+		created = true;
+	}
+
+	void Destroy() {
+		if (created) {
+			for (GpuFrame& frame : gpu_frames) {
+				glDeleteQueries(MaxGpuScopes * 2, frame.queries);
+			}
+			created = false;
+		}
+	}
+
+	void BeginFrame() {
+		Push("frame");
+		GpuFrame& gpu = gpu_frames[frame % 2];
+		gpu.frame = frame;
+		gpu.count = 0;
+		gpu.pending = true;
+	}
+
+	// Reads back the frame before's GPU scopes and, every RefreshFrames
+	// frames, averages what came in since into the overlay lines.
+	void EndFrame() {
+		Pop();
+		++frame;
+		if (created) {
+			Collect(gpu_frames[frame % 2]);
+		}
+		// Held while walking logs: a worker's first scope may add to it meanwhile.
+		std::lock_guard<std::mutex> logs_lock(logs_mutex);
+		for (const std::unique_ptr<ThreadLog>& log : logs) {
+			std::lock_guard<std::mutex> lock(log->mutex);
+			for (const Stat& stat : log->stats) {
+				Find(totals, stat.name, stat.depth).cpu_us += stat.cpu_us;
+			}
+			log->stats.clear();
+		}
+		if (frame % RefreshFrames == 0) {
+			shown = totals;
+			for (Stat& stat : shown) {
+				stat.cpu_us /= RefreshFrames;
+				stat.gpu_us /= RefreshFrames;
+			}
+			totals.clear();
+		}
+	}
+
+	// Lines of "name  cpu ms  gpu ms", top down from (x, y), indented by depth.
+	void PrintOverlay(TextBatch& hud, int x, int y, int size) const {
+		char line[64];
+		hud.Print("scope        cpu ms  gpu ms", x, y, size);
+		for (const Stat& stat : shown) {
+			y -= size;
+			char gpu[16] = "";
+			if (stat.gpu_us > 0.0) {
+				snprintf(gpu, sizeof(gpu), "%6.2f", stat.gpu_us / 1000.0);
+			}
+			snprintf(line, sizeof(line), "%*s%-*.*s %6.2f  %s", stat.depth, "", 12 - stat.depth, 12 - stat.depth, stat.name,
+				stat.cpu_us / 1000.0, gpu);
+			hud.Print(line, x, y, size);
+		}
+	}
+
+	// Every scope so far as complete ("X") events, one row per thread and one
+	// for the GPU.
+	bool WriteTrace(const char* path) {
+		FILE* file = fopen(path, "w");
+		if (file == NULL) {
+			fprintf(stderr, "Impossible to write the trace %s\n", path);
+			return false;
+		}
+		fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"GPU\"}}", GpuThread);
+		std::lock_guard<std::mutex> logs_lock(logs_mutex);
+		for (const std::unique_ptr<ThreadLog>& log : logs) {
+			std::lock_guard<std::mutex> lock(log->mutex);
+			fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+				log->thread, log->thread);
+			WriteEvents(file, log->events, log->thread);
+		}
+		WriteEvents(file, gpu_events, GpuThread);
+		fprintf(file, "\n]}\n");
+		return fclose(file) == 0;
+	}
+
+	// Called by ProfileScope.
+	void Push(const char* name) {
+		ThreadLog& log = Local();
+		{
+			// Listed when opened, so the overlay shows a scope above the ones inside it.
+			std::lock_guard<std::mutex> lock(log.mutex);
+			Find(log.stats, name, (int)log.open.size());
+		}
+		Open open = { name, NowUs() };
+		log.open.push_back(open);
+	}
+
+	void Pop() {
+		double end = NowUs();
+		ThreadLog& log = Local();
+		Open open = log.open.back();
+		log.open.pop_back();
+		int depth = (int)log.open.size();
+		std::lock_guard<std::mutex> lock(log.mutex);
+		Find(log.stats, open.name, depth).cpu_us += end - open.start_us;
+		if (log.events.size() < MaxTraceEvents) {
+			Event event = { open.name, open.start_us, end - open.start_us };
+			log.events.push_back(event);
+		}
+	}
+
+	// Called by GpuProfileScope; -1 once the frame has no queries left.
+	int PushGpu(const char* name) {
+		GpuFrame& gpu = gpu_frames[frame % 2];
+		if (!created || gpu.count == MaxGpuScopes) {
+			return -1;
+		}
+		int scope = gpu.count++;
+		gpu.names[scope] = name;
+		gpu.depths[scope] = (int)Local().open.size() - 1; // its CPU scope is open already
+		glQueryCounter(gpu.queries[scope * 2], GL_TIMESTAMP);
+		return scope;
+	}
+
+	void PopGpu(int scope) {
+		if (scope >= 0) {
+			glQueryCounter(gpu_frames[frame % 2].queries[scope * 2 + 1], GL_TIMESTAMP);
+		}
+	}
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Open {
+		const char* name;
+		double start_us;
+	};
+
+	struct Event {
+		const char* name;
+		double start_us;
+		double duration_us;
+	};
+
+	// Time in a scope, summed by name and depth.
+	struct Stat {
+		const char* name;
+		int depth;
+		double cpu_us;
+		double gpu_us;
+	};
+
+	// One per thread that opened a scope. The owner appends under mutex; the
+	// GL thread reads under it.
+	struct ThreadLog {
+		int thread;
+		std::vector<Open> open;
+		std::vector<Stat> stats;
+		std::vector<Event> events;
+		std::mutex mutex;
+	};
+
+	struct GpuFrame {
+		GLuint queries[MaxGpuScopes * 2];
+		const char* names[MaxGpuScopes];
+		int depths[MaxGpuScopes];
+		int count;
+		uint64_t frame;
+		bool pending;
+	};
+
+	Profiler() : start(Clock::now()), gpu_offset_us(0.0), frame(0), created(false) {}
+
+	double NowUs() const {
+		return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+	}
+
+	// Names are string literals, so the same scope always has the same pointer.
+	static Stat& Find(std::vector<Stat>& stats, const char* name, int depth) {
+		for (Stat& stat : stats) {
+			if (stat.name == name && stat.depth == depth) {
+				return stat;
+			}
+		}
+		Stat stat = { name, depth, 0.0, 0.0 };
+		stats.push_back(stat);
+		return stats.back();
+	}
+
+	ThreadLog& Local() {
+		static thread_local ThreadLog* local = NULL;
+		if (local == NULL) {
+			std::lock_guard<std::mutex> lock(logs_mutex);
+			logs.emplace_back(new ThreadLog());
+			local = logs.back().get();
+			local->thread = (int)logs.size() - 1;
+		}
+		return *local;
+	}
+
+	void Collect(GpuFrame& gpu) {
+		if (!gpu.pending) {
+			return;
+		}
+		for (int scope = 0; scope < gpu.count; ++scope) {
+			GLuint64 begin_ns = 0, end_ns = 0;
+			glGetQueryObjectui64v(gpu.queries[scope * 2], GL_QUERY_RESULT, &begin_ns);
+			glGetQueryObjectui64v(gpu.queries[scope * 2 + 1], GL_QUERY_RESULT, &end_ns);
+			double duration_us = end_ns > begin_ns ? (end_ns - begin_ns) / 1000.0 : 0.0;
+			Find(totals, gpu.names[scope], gpu.depths[scope]).gpu_us += duration_us;
+			if (gpu_events.size() < MaxTraceEvents) {
+				Event event = { gpu.names[scope], gpu_offset_us + begin_ns / 1000.0, duration_us };
+				gpu_events.push_back(event);
+			}
+		}
+		gpu.pending = false;
+	}
+
+	static void WriteEvents(FILE* file, const std::vector<Event>& events, int thread) {
+		for (const Event& event : events) {
+			fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+				event.name, thread, event.start_us, event.duration_us);
+		}
+	}
+
+	Clock::time_point start;
+	double gpu_offset_us;
+	uint64_t frame;
+	bool created;
+	GpuFrame gpu_frames[2]; // [frame % 2]
+	std::vector<Event> gpu_events;
+	std::vector<Stat> totals; // since the overlay was last refreshed
+	std::vector<Stat> shown;
+	std::mutex logs_mutex;
+	std::vector<std::unique_ptr<ThreadLog> > logs; // grown and walked under logs_mutex
+};
+
+class ProfileScope {
+public:
+	explicit ProfileScope(const char* name) { Profiler::Get().Push(name); }
+	~ProfileScope() { Profiler::Get().Pop(); }
+};
+
+class GpuProfileScope {
+public:
+	explicit GpuProfileScope(const char* name) : cpu(name), scope(Profiler::Get().PushGpu(name)) {}
+	~GpuProfileScope() { Profiler::Get().PopGpu(scope); }
+
+private:
+	ProfileScope cpu;
+	int scope;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) GpuProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_GPU_SCOPE(name) ((void)0)
+
+#endif
+
+#endif
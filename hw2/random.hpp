@@ -0,0 +1,51 @@
+#ifndef RANDOM_HPP
+#define RANDOM_HPP
+
+#include <stdint.h>
+
+// PCG32 (O'Neill, pcg-random.org): small, fast, and the same sequence for a
+// seed on every platform, which rand() is not. Everything random in a run
+// draws from one seeded generator, so a seed fixes the whole run.
+class Random {
+public:
+	static const uint64_t DefaultSeed = 1;
+
+	explicit Random(uint64_t seed = DefaultSeed) { Seed(seed); }
+
+	void Seed(uint64_t _seed) {
+		seed = _seed;
+		state = 0;
+		Next();
+		state += seed;
+		Next();
+	}
+
+	uint64_t GetSeed() const { return seed; }
+
+	uint32_t Next() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + Increment;
+		uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = (uint32_t)(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+
+	// Uniform in [lo, hi].
+	int UniformInt(int lo, int hi) {
+		uint64_t range = (uint64_t)(hi - lo) + 1;
+		return lo + (int)((Next() * range) >> 32);
+	}
+
+	// Uniform in [0, 1).
+	double Uniform01() {
+		return Next() * (1.0 / 4294967296.0);
+	}
+
+private:
+	static const uint64_t Increment = 1442695040888963407ULL;
+
+	uint64_t seed;
+	uint64_t state;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef RENDERABLE_HPP
+#define RENDERABLE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <GL/glew.h>
+
+#include "../shared/gl_state_cache.hpp"
+
+// A mesh with its own vertex array object. The vertex buffer, the index buffer
+// and every attribute (per-vertex and per-instance) are recorded in the VAO
+// once at load; a draw binds the VAO, points the instance attributes at this
+// frame's slice of the stream buffer and issues the draw call.
+class Renderable {
+public:
+	static const int MaxInstanceAttribs = 4;
+
+	Renderable() : vao(0), vertex_buffer(0), index_buffer(0), vertex_stride(0), draw_count(0), instance_attrib_count(0), attrib_binding(false), owns_buffers(false) {}
+
+	// Uploads interleaved vertices of stride bytes and, if index_count > 0, a
+	// triangle list of indices into them.
+	void Create(const void* vertices, GLsizei vertex_count, GLsizei stride, const uint32_t* indices = nullptr, GLsizei index_count = 0) {
+		attrib_binding = GLEW_VERSION_4_3 || GLEW_ARB_vertex_attrib_binding;
+		owns_buffers = true;
+		vertex_stride = stride;
+		draw_count = index_count > 0 ? index_count : vertex_count;
+
+		glGenVertexArrays(1, &vao);
+		GLState().BindVertexArray(vao);
+
+		glGenBuffers(1, &vertex_buffer);
+		GLState().BindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertex_count * stride, vertices, GL_STATIC_DRAW);
+
+		if (index_count > 0) {
+			glGenBuffers(1, &index_buffer);
+			GLState().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(uint32_t), indices, GL_STATIC_DRAW);
+		}
+	}
+
+	// A second VAO over the same vertex and index buffers, for drawing the mesh
+	// with its instances coming from somewhere else. The attributes start empty.
+	void CreateShared(const Renderable& other) {
+		attrib_binding = other.attrib_binding;
+		owns_buffers = false;
+		vertex_buffer = other.vertex_buffer;
+		index_buffer = other.index_buffer;
+		vertex_stride = other.vertex_stride;
+		draw_count = other.draw_count;
+
+		glGenVertexArrays(1, &vao);
+		GLState().BindVertexArray(vao);
+		if (index_buffer != 0) {
+			GLState().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+		}
+	}
+
+	void Destroy() {
+		GLState().DeleteVertexArrays(1, &vao);
+		if (owns_buffers) {
+			GLState().DeleteBuffers(1, &vertex_buffer);
+			if (index_buffer != 0) {
+				GLState().DeleteBuffers(1, &index_buffer);
+			}
+		}
+		vao = vertex_buffer = index_buffer = 0;
+	}
+
+	// Float attribute of size components at offset bytes into each vertex.
+	// Create() leaves the VAO bound, so these follow it directly.
+	void VertexAttrib(GLuint index, GLint size, size_t offset) {
+		GLState().BindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+		glEnableVertexAttribArray(index);
+		glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, vertex_stride, (void*)offset);
+		glVertexAttribDivisor(index, 0);
+	}
+
+	// Float attribute advanced once per instance, read from buffer every stride
+	// bytes (0: tightly packed) starting at offset, or at the offset handed to
+	// DrawInstanced.
+	void InstanceAttrib(GLuint index, GLint size, GLuint buffer, GLsizei stride = 0, size_t offset = 0) {
+		AddInstanceAttrib(index, size, GL_FLOAT, buffer, stride, offset);
+	}
+
+	// Same for a uint attribute (e.g. an instance index), read as GLuints.
+	void InstanceAttribI(GLuint index, GLint size, GLuint buffer, GLsizei stride = 0, size_t offset = 0) {
+		AddInstanceAttrib(index, size, GL_UNSIGNED_INT, buffer, stride, offset);
+	}
+
+	// False until Create(), e.g. while the mesh is still loading; draws do
+	// nothing until then.
+	bool Ready() const { return vao != 0; }
+
+	void Draw() const {
+		if (vao == 0) {
+			return;
+		}
+		GLState().BindVertexArray(vao);
+		if (index_buffer != 0) {
+			glDrawElements(GL_TRIANGLES, draw_count, GL_UNSIGNED_INT, (void*)0);
+		}
+		else {
+			glDrawArrays(GL_TRIANGLES, 0, draw_count);
+		}
+	}
+
+	// offsets[i] is where the i-th InstanceAttrib's data starts this frame.
+	void DrawInstanced(GLsizei instances, const GLintptr* offsets) const {
+		DrawInstanced(instances, offsets, 0, draw_count);
+	}
+
+	// Same, drawing count indices (or vertices) from first, e.g. one level of
+	// a MeshLodChain.
+	void DrawInstanced(GLsizei instances, const GLintptr* offsets, GLsizei first, GLsizei count) const {
+		if (instances == 0 || vao == 0) {
+			return;
+		}
+		GLState().BindVertexArray(vao);
+		for (int i = 0; i < instance_attrib_count; ++i) {
+			const InstanceAttribute& a = instance_attribs[i];
+			if (attrib_binding) {
+				// Attribute i was set up with the pointer API, which uses binding point i.
+				glBindVertexBuffer(a.index, a.buffer, offsets[i], a.stride);
+			}
+			else {
+				GLState().BindBuffer(GL_ARRAY_BUFFER, a.buffer);
+				SetAttribPointer(a, offsets[i]);
+			}
+		}
+		if (index_buffer != 0) {
+			glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_INT, (void*)(first * sizeof(uint32_t)), instances);
+		}
+		else {
+			glDrawArraysInstanced(GL_TRIANGLES, first, count, instances);
+		}
+	}
+
+	// Draws with the instance attributes where they were set up and the counts
+	// taken from a DrawElementsIndirectCommand (indexed meshes) or a
+	// DrawArraysIndirectCommand at offset in indirect_buffer. Needs GL 4.0 or
+	// ARB_draw_indirect.
+	void DrawIndirect(GLuint indirect_buffer, GLintptr offset = 0) const {
+		if (vao == 0) {
+			return;
+		}
+		GLState().BindVertexArray(vao);
+		GLState().BindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+		if (index_buffer != 0) {
+			glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset);
+		}
+		else {
+			glDrawArraysIndirect(GL_TRIANGLES, (void*)offset);
+		}
+	}
+
+	// Draw() and friends use only the first count indices, e.g. the finest
+	// level when the coarser ones follow it in the index buffer.
+	void SetDrawCount(GLsizei count) { draw_count = count; }
+
+	bool Indexed() const { return index_buffer != 0; }
+	GLsizei DrawCount() const { return draw_count; }
+
+private:
+	struct InstanceAttribute {
+		GLuint index;
+		GLint size;
+		GLenum type; // GL_FLOAT or GL_UNSIGNED_INT, both 4 bytes
+		GLuint buffer;
+		GLsizei stride;
+	};
+
+	void AddInstanceAttrib(GLuint index, GLint size, GLenum type, GLuint buffer, GLsizei stride, size_t offset) {
+		InstanceAttribute& a = instance_attribs[instance_attrib_count++];
+		a.index = index;
+		a.size = size;
+		a.type = type;
+		a.buffer = buffer;
+		a.stride = stride > 0 ? stride : size * 4;
+		GLState().BindBuffer(GL_ARRAY_BUFFER, buffer);
+		glEnableVertexAttribArray(index);
+		SetAttribPointer(a, offset);
+		glVertexAttribDivisor(index, 1);
+	}
+
+	static void SetAttribPointer(const InstanceAttribute& a, size_t offset) {
+		if (a.type == GL_FLOAT) {
+			glVertexAttribPointer(a.index, a.size, GL_FLOAT, GL_FALSE, a.stride, (void*)offset);
+		}
+		else {
+			glVertexAttribIPointer(a.index, a.size, a.type, a.stride, (void*)offset);
+		}
+	}
+
+	GLuint vao;
+	GLuint vertex_buffer;
+	GLuint index_buffer;
+	GLsizei vertex_stride;
+	GLsizei draw_count;
+	InstanceAttribute instance_attribs[MaxInstanceAttribs];
+	int instance_attrib_count;
+	bool attrib_binding;
+	bool owns_buffers;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef RESIDENT_COLUMN_HPP
+#define RESIDENT_COLUMN_HPP
+
+#include <stddef.h>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "../shared/gl_state_cache.hpp"
+#include "entities.hpp"
+
+// A copy of one instance column that stays on the GPU from frame to frame,
+// in the store's order. Patch() uploads only the slots the store marked as
+// changed, so a column that sits still costs nothing per frame.
+//
+// With a texture format it also gets a buffer texture over the whole buffer,
+// for shaders that fetch an instance's data by index (texelFetch) instead of
+// through attributes.
+class ResidentColumn {
+public:
+	ResidentColumn() : buffer(0), texture(0), capacity(0), element_size(0), frame_bytes(0), total_bytes(0) {}
+
+	// Room for _capacity elements of _element_size bytes. texture_format is
+	// the buffer texture's internal format (GL_RGBA32F for vec4 texels), or 0
+	// for none.
+	void Create(size_t _capacity, size_t _element_size, GLenum texture_format = 0) {
+		capacity = _capacity;
+		element_size = _element_size;
+		glGenBuffers(1, &buffer);
+		GLState().BindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(capacity * element_size), NULL, GL_DYNAMIC_DRAW);
+		if (texture_format != 0) {
+			glGenTextures(1, &texture);
+			GLState().BindTexture(GL_TEXTURE_BUFFER, texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, texture_format, buffer);
+			GLState().BindTexture(GL_TEXTURE_BUFFER, 0);
+		}
+	}
+
+	void Destroy() {
+		GLState().DeleteTextures(1, &texture);
+		GLState().DeleteBuffers(1, &buffer);
+		texture = buffer = 0;
+	}
+
+	// elements is the whole column, count long; uploads the changed slots
+	// below count and returns how many bytes that was.
+	size_t Patch(const void* elements, size_t count, const DirtyRanges& changed) {
+		frame_bytes = 0;
+		count = std::min(count, capacity);
+		for (const DirtyRanges::Range& range : changed.Ranges()) {
+			size_t end = std::min((size_t)range.end, count);
+			if (range.begin >= end) {
+				continue;
+			}
+			if (frame_bytes == 0) {
+				GLState().BindBuffer(GL_ARRAY_BUFFER, buffer);
+			}
+			size_t bytes = (end - range.begin) * element_size;
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(range.begin * element_size), (GLsizeiptr)bytes,
+				(const char*)elements + range.begin * element_size);
+			frame_bytes += bytes;
+		}
+		total_bytes += frame_bytes;
+		return frame_bytes;
+	}
+
+	GLuint Buffer() const { return buffer; }
+	GLuint Texture() const { return texture; }
+	// Bytes the last Patch() uploaded, and all of them so far.
+	size_t FrameBytes() const { return frame_bytes; }
+	size_t TotalBytes() const { return total_bytes; }
+
+private:
+	GLuint buffer;
+	GLuint texture;
+	size_t capacity;
+	size_t element_size;
+	size_t frame_bytes;
+	size_t total_bytes;
+};
+
+#endif
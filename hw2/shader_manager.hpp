@@ -0,0 +1,256 @@
+#ifndef SHADER_MANAGER_HPP
+#define SHADER_MANAGER_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "../shared/gl_state_cache.hpp"
+#include "mapped_file.hpp"
+
+// FNV-1a, 64-bit; pass the last hash in to continue it.
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Vertex/fragment programs, as common/shader.hpp's LoadShaders builds them,
+// but each distinct pair of sources is only built once per run, and the
+// linked program is kept on disk (glGetProgramBinary, GL 4.1 or
+// ARB_get_program_binary) so later runs skip compiling altogether.
+//
+// Cache files sit next to the shaders, named after the driver and source
+// hashes: "<16 hex digits>.glprog". A driver or source change gives another
+// name; a binary the driver turns down anyway (it is free to) is compiled
+// from source again and overwritten.
+//
+// File: "HW2P", u32 version, u64 driver hash, u64 source hash, u32 binary
+// format, u32 binary length, binary.
+class ShaderManager {
+public:
+	static const uint32_t CacheVersion = 1;
+
+	ShaderManager() : use_binaries(false), driver_hash(0), compiled(0), from_cache(0), shared(0), compile_ms(0.0), cache_ms(0.0) {}
+
+	// Needs the context. use_cache false always compiles and writes nothing.
+	void Init(bool use_cache) {
+		const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		uint32_t version = CacheVersion;
+		driver_hash = HashBytes(&version, sizeof(version));
+		for (GLenum name : names) {
+			const char* value = (const char*)glGetString(name);
+			driver_hash = HashBytes(value, value != NULL ? strlen(value) + 1 : 0, driver_hash);
+		}
+		GLint formats = 0;
+		if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		}
+		use_binaries = use_cache && formats > 0;
+	}
+
+	// 0 if a file is missing or the program doesn't build.
+	GLuint Load(const char* vertex_path, const char* fragment_path) {
+		std::string vertex_source, fragment_source;
+		if (!ReadSource(vertex_path, vertex_source) || !ReadSource(fragment_path, fragment_source)) {
+			return 0;
+		}
+		// Each source hashed with its terminator, so moving text from one to the other changes the key.
+		uint64_t source_hash = HashBytes(vertex_source.c_str(), vertex_source.size() + 1);
+		source_hash = HashBytes(fragment_source.c_str(), fragment_source.size() + 1, source_hash);
+		std::unordered_map<uint64_t, GLuint>::iterator found = programs.find(source_hash);
+		if (found != programs.end()) {
+			++shared;
+			return found->second;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::string cache_path = CachePath(source_hash);
+		GLuint program = use_binaries ? LoadBinary(cache_path.c_str(), source_hash) : 0;
+		if (program != 0) {
+			++from_cache;
+			cache_ms += MsSince(start);
+		}
+		else {
+			program = Compile(vertex_path, vertex_source, fragment_path, fragment_source);
+			if (program == 0) {
+				return 0;
+			}
+			if (use_binaries) {
+				SaveBinary(program, cache_path.c_str(), source_hash);
+			}
+			++compiled;
+			compile_ms += MsSince(start);
+		}
+		programs[source_hash] = program;
+		return program;
+	}
+
+	// Deletes every program Load() returned.
+	void Destroy() {
+		for (const std::pair<const uint64_t, GLuint>& entry : programs) {
+			GLState().DeleteProgram(entry.second);
+		}
+		programs.clear();
+	}
+
+	bool UsesBinaries() const { return use_binaries; }
+	// Programs built from source and loaded from the cache, with the time each
+	// took, and Load() calls answered with an existing program.
+	int Compiled() const { return compiled; }
+	int FromCache() const { return from_cache; }
+	int Shared() const { return shared; }
+	double CompileMs() const { return compile_ms; }
+	double CacheMs() const { return cache_ms; }
+
+private:
+	struct CacheHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t driver_hash;
+		uint64_t source_hash;
+		uint32_t format;
+		uint32_t length;
+	};
+
+	static double MsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	static bool ReadSource(const char* path, std::string& source) {
+		std::ifstream file(path);
+		if (!file.is_open()) {
+			fprintf(stderr, "Impossible to open %s. Are you in the right directory ?\n", path);
+			return false;
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		source = stream.str();
+		return true;
+	}
+
+	std::string CachePath(uint64_t source_hash) const {
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.glprog", (unsigned long long)HashBytes(&driver_hash, sizeof(driver_hash), source_hash));
+		return name;
+	}
+
+	static GLuint CompileShader(GLenum type, const char* path, const std::string& source) {
+		const char* source_ptr = source.c_str();
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source_ptr, NULL);
+		glCompileShader(shader);
+		GLint status = GL_FALSE;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+		if (status != GL_TRUE) {
+			GLint length = 0;
+			glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+			std::vector<char> log(length + 1);
+			glGetShaderInfoLog(shader, length, NULL, &log[0]);
+			fprintf(stderr, "%s: %s\n", path, &log[0]);
+		}
+		return shader;
+	}
+
+	GLuint Compile(const char* vertex_path, const std::string& vertex_source, const char* fragment_path, const std::string& fragment_source) {
+		GLuint vertex_shader = CompileShader(GL_VERTEX_SHADER, vertex_path, vertex_source);
+		GLuint fragment_shader = CompileShader(GL_FRAGMENT_SHADER, fragment_path, fragment_source);
+		GLuint program = glCreateProgram();
+		glAttachShader(program, vertex_shader);
+		glAttachShader(program, fragment_shader);
+		if (use_binaries) {
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		glLinkProgram(program);
+		glDetachShader(program, vertex_shader);
+		glDetachShader(program, fragment_shader);
+		glDeleteShader(vertex_shader);
+		glDeleteShader(fragment_shader);
+		GLint status = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE) {
+			GLint length = 0;
+			glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+			std::vector<char> log(length + 1);
+			glGetProgramInfoLog(program, length, NULL, &log[0]);
+			fprintf(stderr, "%s + %s: %s\n", vertex_path, fragment_path, &log[0]);
+			GLState().DeleteProgram(program);
+			return 0;
+		}
+		return program;
+	}
+
+	// 0 if there is no usable binary for this driver and source.
+	GLuint LoadBinary(const char* path, uint64_t source_hash) const {
+		MappedFile file;
+		if (!file.Open(path) || file.Size() < sizeof(CacheHeader)) {
+			return 0;
+		}
+		CacheHeader header;
+		memcpy(&header, file.Data(), sizeof(header));
+		if (memcmp(header.magic, "HW2P", 4) != 0 || header.version != CacheVersion || header.driver_hash != driver_hash ||
+			header.source_hash != source_hash || file.Size() != sizeof(CacheHeader) + header.length) {
+			return 0;
+		}
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, header.format, file.Data() + sizeof(CacheHeader), (GLsizei)header.length);
+		GLint status = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE) {
+			GLState().DeleteProgram(program);
+			return 0;
+		}
+		return program;
+	}
+
+	void SaveBinary(GLuint program, const char* path, uint64_t source_hash) const {
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) {
+			return;
+		}
+		std::vector<uint8_t> binary(length);
+		CacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "HW2P", 4);
+		header.version = CacheVersion;
+		header.driver_hash = driver_hash;
+		header.source_hash = source_hash;
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+		header.format = format;
+		header.length = (uint32_t)length;
+
+		FILE* file = fopen(path, "wb");
+		if (file == NULL) {
+			return;
+		}
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+		ok = ok && fwrite(binary.data(), 1, header.length, file) == header.length;
+		ok = fclose(file) == 0 && ok;
+		if (!ok) {
+			remove(path);
+		}
+	}
+
+	bool use_binaries;
+	uint64_t driver_hash;
+	std::unordered_map<uint64_t, GLuint> programs; // by source hash
+	int compiled;
+	int from_cache;
+	int shared;
+	double compile_ms;
+	double cache_ms;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef SIMD_KERNELS_HPP
+#define SIMD_KERNELS_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The vector path is picked at compile time: AVX when the compiler targets it
+// (-mavx, /arch:AVX), otherwise SSE2, which every x86-64 compiler enables by default.
+// Everything else gets the scalar loops, which are also kept as the reference.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_KERNELS_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_KERNELS_SSE 1
+#endif
+
+inline const char* SimdPathName() {
+#if defined(SIMD_KERNELS_AVX)
+	return "avx";
+#elif defined(SIMD_KERNELS_SSE)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+// x[i] += v[i] * t for i in [0, n)
+inline void AxpyScalar(float* x, const float* v, float t, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		x[i] += v[i] * t;
+	}
+}
+
+inline void Axpy(float* x, const float* v, float t, size_t n) {
+	size_t i = 0;
+#if defined(SIMD_KERNELS_AVX)
+	__m256 t8 = _mm256_set1_ps(t);
+	for (; i + 8 <= n; i += 8) {
+		__m256 r = _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(_mm256_loadu_ps(v + i), t8));
+		_mm256_storeu_ps(x + i, r);
+	}
+#elif defined(SIMD_KERNELS_SSE)
+	__m128 t4 = _mm_set1_ps(t);
+	for (; i + 4 <= n; i += 4) {
+		__m128 r = _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(_mm_loadu_ps(v + i), t4));
+		_mm_storeu_ps(x + i, r);
+	}
+#endif
+	AxpyScalar(x + i, v + i, t, n - i);
+}
+
+// out[i] = a[i] + (b[i] - a[i]) * t for i in [0, n). out is written once, in
+// order, so it can point at write-combined mapped buffer memory.
+inline void LerpScalar(float* out, const float* a, const float* b, float t, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		out[i] = a[i] + (b[i] - a[i]) * t;
+	}
+}
+
+inline void Lerp(float* out, const float* a, const float* b, float t, size_t n) {
+	size_t i = 0;
+#if defined(SIMD_KERNELS_AVX)
+	__m256 t8 = _mm256_set1_ps(t);
+	for (; i + 8 <= n; i += 8) {
+		__m256 va = _mm256_loadu_ps(a + i);
+		__m256 r = _mm256_add_ps(va, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(b + i), va), t8));
+		_mm256_storeu_ps(out + i, r);
+	}
+#elif defined(SIMD_KERNELS_SSE)
+	__m128 t4 = _mm_set1_ps(t);
+	for (; i + 4 <= n; i += 4) {
+		__m128 va = _mm_loadu_ps(a + i);
+		__m128 r = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b + i), va), t4));
+		_mm_storeu_ps(out + i, r);
+	}
+#endif
+	LerpScalar(out + i, a + i, b + i, t, n - i);
+}
+
+// Flags written by SphereContacts.
+enum {
+	ContactNear = 1, // distance <= r[i] + radius + margin
+	ContactHit = 2,  // distance <= r[i] + radius
+};
+
+// Tests the spheres (x[i], y[i], z[i], r[i]) against one sphere at (cx, cy, cz)
+// with the given radius. Distances are compared squared, so no sqrt is taken.
+// Writes one flags byte per sphere and returns true if any flag was set.
+inline bool SphereContactsScalar(const float* x, const float* y, const float* z, const float* r, size_t n,
+	float cx, float cy, float cz, float radius, float margin, uint8_t* flags) {
+	uint8_t any = 0;
+	for (size_t i = 0; i < n; ++i) {
+		float dx = x[i] - cx, dy = y[i] - cy, dz = z[i] - cz;
+		float d2 = dx * dx + dy * dy + dz * dz;
+		float hit = r[i] + radius;
+		float near_ = hit + margin;
+		uint8_t f = (d2 <= near_ * near_ ? ContactNear : 0) | (d2 <= hit * hit ? ContactHit : 0);
+		flags[i] = f;
+		any |= f;
+	}
+	return any != 0;
+}
+
+// Expands the lane masks from a vector compare into flag bytes.
+inline int StoreContactFlags(int near_mask, int hit_mask, size_t width, uint8_t* flags) {
+	for (size_t k = 0; k < width; ++k) {
+		flags[k] = (uint8_t)(((near_mask >> k) & 1) * ContactNear | ((hit_mask >> k) & 1) * ContactHit);
+	}
+	return near_mask | hit_mask;
+}
+
+inline bool SphereContacts(const float* x, const float* y, const float* z, const float* r, size_t n,
+	float cx, float cy, float cz, float radius, float margin, uint8_t* flags) {
+	size_t i = 0;
+	int any = 0;
+#if defined(SIMD_KERNELS_AVX)
+	__m256 px = _mm256_set1_ps(cx), py = _mm256_set1_ps(cy), pz = _mm256_set1_ps(cz);
+	__m256 rad = _mm256_set1_ps(radius), mar = _mm256_set1_ps(margin);
+	for (; i + 8 <= n; i += 8) {
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), px);
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), py);
+		__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z + i), pz);
+		__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		__m256 hit = _mm256_add_ps(_mm256_loadu_ps(r + i), rad);
+		__m256 near_ = _mm256_add_ps(hit, mar);
+		int near_mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_mul_ps(near_, near_), _CMP_LE_OQ));
+		int hit_mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_mul_ps(hit, hit), _CMP_LE_OQ));
+		any |= StoreContactFlags(near_mask, hit_mask, 8, flags + i);
+	}
+#elif defined(SIMD_KERNELS_SSE)
+	__m128 px = _mm_set1_ps(cx), py = _mm_set1_ps(cy), pz = _mm_set1_ps(cz);
+	__m128 rad = _mm_set1_ps(radius), mar = _mm_set1_ps(margin);
+	for (; i + 4 <= n; i += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), px);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), py);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), pz);
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128 hit = _mm_add_ps(_mm_loadu_ps(r + i), rad);
+		__m128 near_ = _mm_add_ps(hit, mar);
+		int near_mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_mul_ps(near_, near_)));
+		int hit_mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_mul_ps(hit, hit)));
+		any |= StoreContactFlags(near_mask, hit_mask, 4, flags + i);
+	}
+#endif
+	bool tail = SphereContactsScalar(x + i, y + i, z + i, r + i, n - i, cx, cy, cz, radius, margin, flags + i);
+	return any != 0 || tail;
+}
+
+#endif
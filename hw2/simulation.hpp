@@ -0,0 +1,118 @@
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+#include <glm/glm.hpp>
+
+#include "collision_grid.hpp"
+#include "entities.hpp"
+#include "job_system.hpp"
+#include "simd_kernels.hpp"
+
+// The per-tick simulation steps that only touch the entity stores.
+// They have no GL or input dependencies, so benchmark.cpp runs them as they are.
+//
+// Each takes an optional JobSystem and then works through its entities in
+// chunks of SimGrain in parallel; without one, or with fewer entities than
+// that (hw2's usual case), it runs as a plain loop.
+
+const size_t SimGrain = 4096;
+
+// pos += dir * speed * delta, over all fireballs at once; exploding fireballs grow.
+// The position before the step is kept in prev_pos for interpolation.
+inline void MoveFireballs(FireballStore& fireballs, float delta, JobSystem* jobs = NULL) {
+	fireballs.prev_pos.resize(fireballs.Count());
+	ParallelFor(jobs, fireballs.Count(), SimGrain, [&fireballs, delta](size_t begin, size_t end) {
+		std::copy(fireballs.pos.begin() + begin, fireballs.pos.begin() + end, fireballs.prev_pos.begin() + begin);
+		Axpy(reinterpret_cast<float*>(fireballs.pos.data() + begin), reinterpret_cast<const float*>(fireballs.velocity.data() + begin),
+			delta, 3 * (end - begin));
+		for (size_t i = begin; i < end; ++i) {
+			if (fireballs.explode[i] && fireballs.coeff[i] < 1.0f) {
+				fireballs.coeff[i] += 0.1f;
+			}
+		}
+	});
+}
+
+// Writes the fireball instance data for a frame drawn alpha of the way from the
+// previous step to the current one straight into out_pos/out_coeff (mapped memory).
+// Same, from copies of the prev_pos, pos and coeff columns.
+inline void InterpolateFireballs(const glm::vec3* prev_pos, const glm::vec3* pos, const float* coeff, size_t count, float alpha,
+	glm::vec3* out_pos, float* out_coeff, JobSystem* jobs = NULL) {
+	ParallelFor(jobs, count, SimGrain, [=](size_t begin, size_t end) {
+		Lerp(reinterpret_cast<float*>(out_pos + begin), reinterpret_cast<const float*>(prev_pos + begin),
+			reinterpret_cast<const float*>(pos + begin), alpha, 3 * (end - begin));
+		memcpy(out_coeff + begin, coeff + begin, (end - begin) * sizeof(float));
+	});
+}
+
+inline void InterpolateFireballs(const FireballStore& fireballs, float alpha, glm::vec3* out_pos, float* out_coeff, JobSystem* jobs = NULL) {
+	InterpolateFireballs(fireballs.prev_pos.data(), fireballs.pos.data(), fireballs.coeff.data(), fireballs.Count(), alpha,
+		out_pos, out_coeff, jobs);
+}
+
+// Per-chunk scratch for CollideFireballs, kept between ticks: the contact
+// kernel's flags, and the objects each chunk hit, which are only marked dead
+// once every chunk is done.
+struct CollisionScratch {
+	std::vector<std::vector<uint8_t> > flags;
+	std::vector<std::vector<uint32_t> > hits;
+};
+
+// Marks fireballs that come within size + size + 1 of an object as exploding,
+// and both sides of any pair within size + size as dead. Nothing is removed here.
+inline void CollideFireballs(ObjectStore& objects, FireballStore& fireballs, CollisionGrid& grid, CollisionScratch& scratch,
+	JobSystem* jobs = NULL) {
+	// Bucket the objects once per tick so every fireball only tests its neighbours.
+	float max_object_size = 0.0f;
+	for (float size : objects.size) {
+		max_object_size = std::max(max_object_size, size);
+	}
+	float max_fireball_size = 0.0f;
+	for (float size : fireballs.size) {
+		max_fireball_size = std::max(max_fireball_size, size);
+	}
+	// Largest explode radius of any pair; no pair further apart than this can interact.
+	float max_radius = max_object_size + max_fireball_size + 1;
+	grid.Build(objects.pos.data(), objects.size.data(), objects.Count(), max_radius);
+
+	// A chunk only writes its own fireballs' flags and its own scratch.
+	size_t chunks = JobSystem::ChunkCount(fireballs.Count(), SimGrain);
+	scratch.flags.resize(std::max(scratch.flags.size(), chunks));
+	scratch.hits.resize(std::max(scratch.hits.size(), chunks));
+	ParallelFor(jobs, fireballs.Count(), SimGrain, [&](size_t first, size_t last) {
+		std::vector<uint8_t>& flags = scratch.flags[first / SimGrain];
+		std::vector<uint32_t>& hits = scratch.hits[first / SimGrain];
+		flags.resize(objects.Count());
+		hits.clear();
+		for (size_t f = first; f < last; ++f) {
+			glm::vec3 p = fireballs.pos[f];
+			grid.QueryRanges(p, max_radius, [&](uint32_t begin, uint32_t end) {
+				if (!SphereContacts(grid.X() + begin, grid.Y() + begin, grid.Z() + begin, grid.Radius() + begin,
+					end - begin, p.x, p.y, p.z, fireballs.size[f], 1.0f, flags.data())) {
+					return;
+				}
+				for (uint32_t k = 0; k < end - begin; ++k) {
+					if (flags[k] & ContactNear) {
+						fireballs.explode[f] = 1;
+					}
+					if (flags[k] & ContactHit) {
+						fireballs.is_alive[f] = 0;
+						hits.push_back(grid.Entity(begin + k));
+					}
+				}
+			});
+		}
+	});
+	for (size_t c = 0; c < chunks; ++c) {
+		for (uint32_t o : scratch.hits[c]) {
+			objects.is_alive[o] = 0;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef STREAM_BUFFER_HPP
+#define STREAM_BUFFER_HPP
+
+#include <stddef.h>
+
+#include <GL/glew.h>
+
+#include "../shared/gl_state_cache.hpp"
+
+// Ring of Regions equally sized slices of one vertex buffer, used for data that
+// is rewritten every frame (instance attributes). Each frame writes into its own
+// slice and fences it after the draws that read it, so the CPU never writes
+// memory the GPU may still be reading and the buffer is never reallocated.
+//
+// With GL 4.4 / ARB_buffer_storage the whole buffer is mapped once, persistently
+// and coherently. Otherwise (plain GL 3.3) the current slice is mapped every
+// frame with GL_MAP_UNSYNCHRONIZED_BIT, which is safe because of the fences.
+//
+// Per frame:
+//     Begin();  ptr = Allocate(bytes, &offset) ...;  End();
+//     draw with attribute offsets from Allocate();
+//     Fence();
+class StreamBuffer {
+public:
+	static const int Regions = 3;
+
+	StreamBuffer() : buffer(0), region_size(0), region(0), persistent(false), base(nullptr), mapped(nullptr), used(0),
+		frame_bytes(0), frame_stalls(0), total_bytes(0), total_stalls(0) {
+		for (int i = 0; i < Regions; ++i) {
+			fences[i] = 0;
+		}
+	}
+
+	void Create(GLsizeiptr regionSize) {
+		region_size = regionSize;
+		persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+		glGenBuffers(1, &buffer);
+		GLState().BindBuffer(GL_ARRAY_BUFFER, buffer);
+		if (persistent) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_ARRAY_BUFFER, Regions * region_size, nullptr, flags);
+			base = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, Regions * region_size, flags);
+			if (base == nullptr) {
+				// Storage is immutable now, so fall back on a fresh buffer.
+				GLState().DeleteBuffers(1, &buffer);
+				glGenBuffers(1, &buffer);
+				GLState().BindBuffer(GL_ARRAY_BUFFER, buffer);
+				persistent = false;
+			}
+		}
+		if (!persistent) {
+			glBufferData(GL_ARRAY_BUFFER, Regions * region_size, nullptr, GL_STREAM_DRAW);
+		}
+	}
+
+	void Destroy() {
+		for (int i = 0; i < Regions; ++i) {
+			if (fences[i]) {
+				glDeleteSync(fences[i]);
+				fences[i] = 0;
+			}
+		}
+		if (buffer) {
+			if (persistent) {
+				GLState().BindBuffer(GL_ARRAY_BUFFER, buffer);
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+			}
+			GLState().DeleteBuffers(1, &buffer);
+			buffer = 0;
+		}
+	}
+
+	// Waits until the GPU is done with the current slice and makes it writable.
+	void Begin() {
+		WaitForRegion(region);
+		frame_bytes = 0;
+		used = 0;
+		if (persistent) {
+			mapped = base + region * region_size;
+		}
+		else {
+			GLState().BindBuffer(GL_ARRAY_BUFFER, buffer);
+			mapped = (char*)glMapBufferRange(GL_ARRAY_BUFFER, region * region_size, region_size,
+				GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+		}
+	}
+
+	// Reserves bytes in the current slice. Returns where to write them, and the
+	// buffer offset to pass to glVertexAttribPointer in *offset.
+	void* Allocate(GLsizeiptr bytes, GLintptr* offset) {
+		const GLsizeiptr Alignment = 16;
+		GLsizeiptr start = (used + Alignment - 1) & ~(Alignment - 1);
+		if (mapped == nullptr || start + bytes > region_size) {
+			*offset = region * region_size;
+			return nullptr;
+		}
+		used = start + bytes;
+		frame_bytes += bytes;
+		*offset = region * region_size + start;
+		return mapped + start;
+	}
+
+	// Makes the writes visible to GL; call before the draws.
+	void End() {
+		if (!persistent && mapped != nullptr) {
+			GLState().BindBuffer(GL_ARRAY_BUFFER, buffer);
+			glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, used);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		}
+		mapped = nullptr;
+		total_bytes += frame_bytes;
+	}
+
+	// Fences the slice after the last draw that reads it and moves to the next one.
+	void Fence() {
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		region = (region + 1) % Regions;
+	}
+
+	GLuint Buffer() const { return buffer; }
+	bool Persistent() const { return persistent; }
+	// Bytes written and fence waits that actually blocked, for the last frame and since Create.
+	size_t FrameBytes() const { return frame_bytes; }
+	int FrameStalls() const { return frame_stalls; }
+	size_t TotalBytes() const { return total_bytes; }
+	int TotalStalls() const { return total_stalls; }
+
+private:
+	void WaitForRegion(int r) {
+		frame_stalls = 0;
+		if (!fences[r]) {
+			return;
+		}
+		GLenum result = glClientWaitSync(fences[r], 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED) {
+			++frame_stalls;
+			++total_stalls;
+			do {
+				result = glClientWaitSync(fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while (result == GL_TIMEOUT_EXPIRED);
+		}
+		glDeleteSync(fences[r]);
+		fences[r] = 0;
+	}
+
+	GLuint buffer;
+	GLsizeiptr region_size;
+	int region;
+	bool persistent;
+	char* base;
+	char* mapped;
+	GLsizeiptr used;
+	GLsync fences[Regions];
+
+	size_t frame_bytes;
+	int frame_stalls;
+	size_t total_bytes;
+	int total_stalls;
+};
+
+#endif
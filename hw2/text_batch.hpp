@@ -0,0 +1,163 @@
+#ifndef TEXT_BATCH_HPP
+#define TEXT_BATCH_HPP
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <GL/glew.h>
+
+#include "../shared/gl_state_cache.hpp"
+
+// Screen text for a frame, drawn in one call. Same font texture, shaders and
+// layout as common/text2D: 800x600 screen space, (x, y) is the bottom left of
+// the first character and size its width and height.
+//
+// Each distinct (text, x, y, size) is tessellated once and cached, so a HUD
+// that prints the same strings every frame only builds quads for a string
+// the first time it appears (e.g. when a counter changes). The vertex buffer
+// is only rewritten on frames whose list of strings differs from the last.
+//
+// Per frame:
+//     Print(...); Print(...); ...; Draw();
+class TextBatch {
+public:
+	static const int MaxCharacters = 1024;
+	// Strings that were not printed last frame are dropped past this many.
+	static const size_t MaxCachedStrings = 64;
+
+	TextBatch() : program(0), texture(0), sampler_location(-1), vao(0), vertex_buffer(0), vertex_count(0), frame(0),
+		tessellated(0), uploads(0) {}
+
+	// program is the TextVertexShader pair, texture the font.
+	void Create(GLuint _program, GLuint _texture) {
+		program = _program;
+		texture = _texture;
+		sampler_location = glGetUniformLocation(program, "myTextureSampler");
+
+		glGenVertexArrays(1, &vao);
+		GLState().BindVertexArray(vao);
+		glGenBuffers(1, &vertex_buffer);
+		GLState().BindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+		glBufferData(GL_ARRAY_BUFFER, MaxCharacters * 6 * sizeof(Vertex), nullptr, GL_DYNAMIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(2 * sizeof(float)));
+	}
+
+	void Destroy() {
+		GLState().DeleteVertexArrays(1, &vao);
+		GLState().DeleteBuffers(1, &vertex_buffer);
+		vao = vertex_buffer = 0;
+		cache.clear();
+		printed.clear();
+		uploaded.clear();
+	}
+
+	void Print(const char* text, int x, int y, int size) {
+		char position[48];
+		snprintf(position, sizeof(position), "%d %d %d ", x, y, size);
+		std::string key = position;
+		key += text;
+		std::unordered_map<std::string, CachedString>::iterator found = cache.find(key);
+		if (found == cache.end()) {
+			found = cache.emplace(key, CachedString()).first;
+			Tessellate(text, x, y, size, found->second.vertices);
+			++tessellated;
+		}
+		found->second.last_frame = frame;
+		printed.push_back(&found->second);
+	}
+
+	// Draws everything printed since the last Draw.
+	void Draw() {
+		if (printed != uploaded) {
+			staging.clear();
+			for (const CachedString* s : printed) {
+				staging.insert(staging.end(), s->vertices.begin(), s->vertices.end());
+			}
+			if (staging.size() > MaxCharacters * 6) {
+				fprintf(stderr, "TextBatch: more than %d characters in a frame, the rest are not drawn\n", MaxCharacters);
+				staging.resize(MaxCharacters * 6);
+			}
+			vertex_count = (GLsizei)staging.size();
+			GLState().BindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+			// Orphan the old contents so the upload never waits on last frame's draw.
+			glBufferData(GL_ARRAY_BUFFER, MaxCharacters * 6 * sizeof(Vertex), nullptr, GL_DYNAMIC_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, vertex_count * sizeof(Vertex), staging.data());
+			uploaded = printed;
+			++uploads;
+		}
+
+		if (vertex_count > 0) {
+			GLState().UseProgram(program);
+			GLState().ActiveTexture(GL_TEXTURE0);
+			GLState().BindTexture(GL_TEXTURE_2D, texture);
+			GLState().Uniform1i(sampler_location, 0);
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			GLState().BindVertexArray(vao);
+			glDrawArrays(GL_TRIANGLES, 0, vertex_count);
+			glDisable(GL_BLEND);
+		}
+
+		if (cache.size() > MaxCachedStrings) {
+			for (std::unordered_map<std::string, CachedString>::iterator it = cache.begin(); it != cache.end();) {
+				it = it->second.last_frame != frame ? cache.erase(it) : ++it;
+			}
+		}
+		printed.clear();
+		++frame;
+	}
+
+	// Strings tessellated and vertex buffer uploads so far.
+	unsigned long Tessellated() const { return tessellated; }
+	unsigned long Uploads() const { return uploads; }
+
+private:
+	struct Vertex {
+		float x, y;
+		float u, v;
+	};
+
+	struct CachedString {
+		std::vector<Vertex> vertices;
+		unsigned long last_frame;
+	};
+
+	// Two triangles per character, from the 16x16 character grid of the font.
+	static void Tessellate(const char* text, int x, int y, int size, std::vector<Vertex>& out) {
+		const float cell = 1.0f / 16.0f;
+		for (int i = 0; text[i] != '\0'; ++i) {
+			float left = (float)(x + i * size), right = left + size;
+			float bottom = (float)y, top = bottom + size;
+			char character = text[i];
+			float u = (character % 16) / 16.0f;
+			float v = (character / 16) / 16.0f;
+			Vertex up_left = { left, top, u, v };
+			Vertex up_right = { right, top, u + cell, v };
+			Vertex down_right = { right, bottom, u + cell, v + cell };
+			Vertex down_left = { left, bottom, u, v + cell };
+			Vertex quad[6] = { up_left, down_left, up_right, down_right, up_right, down_left };
+			out.insert(out.end(), quad, quad + 6);
+		}
+	}
+
+	GLuint program;
+	GLuint texture;
+	GLint sampler_location;
+	GLuint vao;
+	GLuint vertex_buffer;
+	GLsizei vertex_count;
+	unsigned long frame;
+	std::unordered_map<std::string, CachedString> cache;
+	std::vector<const CachedString*> printed;  // this frame
+	std::vector<const CachedString*> uploaded; // what the vertex buffer holds
+	std::vector<Vertex> staging;
+	unsigned long tessellated;
+	unsigned long uploads;
+};
+
+#endif
@@ -0,0 +1,385 @@
+#ifndef TEXTURE_CACHE_HPP
+#define TEXTURE_CACHE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "../shared/gl_state_cache.hpp"
+#include "mapped_file.hpp"
+
+// A DXT1/3/5 DDS file, mapped. Its mip levels are uploaded straight from the
+// mapping, so nothing is read or copied until a level is needed.
+struct DdsFile {
+	static const int MaxLevels = 16;
+
+	struct Level {
+		size_t offset;
+		size_t size;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	MappedFile file;
+	GLenum format;
+	int level_count;
+	Level levels[MaxLevels];
+
+	DdsFile() : format(0), level_count(0) {}
+
+	// Maps path and reads the header (same formats and layout as
+	// common/texture.hpp's loadDDS).
+	bool Open(const char* path) {
+		if (!file.Open(path) || file.Size() < 128 || memcmp(file.Data(), "DDS ", 4) != 0) {
+			fprintf(stderr, "%s is not a DDS file.\n", path);
+			return false;
+		}
+		const unsigned char* header = file.Data() + 4;
+		uint32_t height, width, mip_count, four_cc;
+		memcpy(&height, &header[8], 4);
+		memcpy(&width, &header[12], 4);
+		memcpy(&mip_count, &header[24], 4);
+		memcpy(&four_cc, &header[80], 4);
+		switch (four_cc) {
+		case 0x31545844: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break; // "DXT1"
+		case 0x33545844: format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; break; // "DXT3"
+		case 0x35545844: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break; // "DXT5"
+		default:
+			fprintf(stderr, "%s is not DXT1, DXT3 or DXT5.\n", path);
+			return false;
+		}
+		size_t block_size = format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 8 : 16;
+		size_t offset = 128;
+		level_count = 0;
+		for (uint32_t i = 0; i < mip_count && level_count < MaxLevels; ++i) {
+			size_t size = ((width + 3) / 4) * ((height + 3) / 4) * block_size;
+			if (offset + size > file.Size()) {
+				break;
+			}
+			Level level = { offset, size, width, height };
+			levels[level_count++] = level;
+			offset += size;
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+		}
+		return level_count > 0;
+	}
+
+	// Reads every page once, so that uploads from the mapping don't wait on
+	// the disk; for a loader thread.
+	void Prefetch() const {
+		volatile unsigned char sum = 0;
+		for (size_t i = 0; i < file.Size(); i += 4096) {
+			sum += file.Data()[i];
+		}
+	}
+
+	const char* FormatName() const {
+		return format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? "DXT1" : format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT ? "DXT3" : "DXT5";
+	}
+
+	// Same format, size and levels, so both fit one texture array.
+	bool SameLayout(const DdsFile& other) const {
+		return format == other.format && level_count == other.level_count &&
+			levels[0].width == other.levels[0].width && levels[0].height == other.levels[0].height;
+	}
+};
+
+// Groups files by layout, each group to become one GL_TEXTURE_2D_ARRAY: the
+// indices of its files, which are also their layers, in the order given.
+inline std::vector<std::vector<size_t> > PackTextureArrays(const std::vector<std::shared_ptr<DdsFile> >& files) {
+	std::vector<std::vector<size_t> > groups;
+	for (size_t i = 0; i < files.size(); ++i) {
+		size_t g = 0;
+		while (g < groups.size() && !files[groups[g][0]]->SameLayout(*files[i])) {
+			++g;
+		}
+		if (g == groups.size()) {
+			groups.push_back(std::vector<size_t>());
+		}
+		groups[g].push_back(i);
+	}
+	return groups;
+}
+
+// A 1x1 texture (or one-layer array) of one RGBA colour, to bind until the
+// real one is uploaded.
+inline GLuint CreatePlaceholderTexture(uint8_t r, uint8_t g, uint8_t b, uint8_t a, GLenum target = GL_TEXTURE_2D) {
+	uint8_t texel[4] = { r, g, b, a };
+	GLuint texture;
+	glGenTextures(1, &texture);
+	GLState().BindTexture(target, texture);
+	if (target == GL_TEXTURE_2D_ARRAY) {
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+	}
+	else {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+	}
+	return texture;
+}
+
+// The shortest model-space distance a unit of uv covers along any edge of a
+// mesh (Vertex has pos and uv), i.e. how long the texture is where it is
+// densest. Times pixels per model unit, that is pixels per texture width.
+template <typename Vertex>
+float MinUnitsPerUv(const Vertex* vertices, const uint32_t* indices, size_t index_count) {
+	float units_per_uv = 1e30f;
+	for (size_t t = 0; t + 2 < index_count; t += 3) {
+		for (int e = 0; e < 3; ++e) {
+			const Vertex& a = vertices[indices[t + e]];
+			const Vertex& b = vertices[indices[t + (e + 1) % 3]];
+			float uv = glm::length(b.uv - a.uv);
+			if (uv > 1e-6f) {
+				units_per_uv = std::min(units_per_uv, glm::length(b.pos - a.pos) / uv);
+			}
+		}
+	}
+	return units_per_uv;
+}
+
+// Streamed DDS textures within a memory budget. Add() uploads only the small
+// levels (the mip tail) and after that each texture only gets the finer
+// levels someone Request()s, one level at a time from the tail up, at most
+// MaxUploadBytesPerFrame a frame. GL_TEXTURE_BASE_LEVEL is kept at the finest
+// resident level, so a texture is always complete, just blurrier until its
+// levels arrive.
+//
+// When a level does not fit the budget, the least recently requested
+// textures give up their finest levels first; those are respecified empty,
+// which frees their storage. A texture never drops a level it was asked for
+// this frame, nor its tail.
+//
+// Texture arrays stream the same way, a level for every layer at once.
+//
+// Textures are bound on the active unit to upload them, so keep one unit
+// active for that (and transient binds) between draws.
+//
+// Per frame: Request(...) for what is drawn, then Update().
+class TextureCache {
+public:
+	// Levels up to this size are uploaded on Add() and never evicted.
+	static const uint32_t TailSize = 64;
+	static const size_t MaxUploadBytesPerFrame = 1 << 20;
+
+	explicit TextureCache(size_t _budget = 64 << 20) : budget(_budget), resident(0), frame(1), level_uploads(0), evictions(0) {}
+
+	// Takes texture (e.g. a placeholder) over with the file's levels. load_ms
+	// is how long mapping the file took, to report with the upload time.
+	void Add(const char* name, GLuint texture, std::shared_ptr<DdsFile> dds, double load_ms) {
+		Entry entry;
+		entry.name = name;
+		entry.texture = texture;
+		entry.target = GL_TEXTURE_2D;
+		entry.owned = false;
+		entry.layers.push_back(dds);
+		// The placeholder's level 0 goes unless the file's level 0 replaces it.
+		GLState().BindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		Insert(entry, load_ms);
+	}
+
+	// A new texture array of layers, which PackTextureArrays() grouped; the
+	// cache deletes it on Destroy().
+	GLuint AddArray(const std::string& name, const std::vector<std::shared_ptr<DdsFile> >& layers, double load_ms) {
+		Entry entry;
+		entry.name = name;
+		glGenTextures(1, &entry.texture);
+		entry.target = GL_TEXTURE_2D_ARRAY;
+		entry.owned = true;
+		entry.layers = layers;
+		Insert(entry, load_ms);
+		return entry.texture;
+	}
+
+	// Deletes the texture arrays AddArray() made.
+	void Destroy() {
+		for (Entry& entry : entries) {
+			if (entry.owned) {
+				GLState().DeleteTextures(1, &entry.texture);
+			}
+		}
+		entries.clear();
+		resident = 0;
+	}
+
+	// texture is drawn this frame with at most pixels_per_uv pixels per unit
+	// of uv (the texture's width) on screen, and sampled with bias (e.g. the
+	// -2.0 of TextureFragmentShaderLOD); it needs the level it is sampled at,
+	// log2 of texels per pixel plus the bias. Textures still loading are
+	// ignored.
+	void Request(GLuint texture, float pixels_per_uv, float bias) {
+		Entry* entry = Find(texture);
+		if (entry == NULL) {
+			return;
+		}
+		const DdsFile::Level& full = entry->layers[0]->levels[0];
+		float lod = log2f(std::max(full.width, full.height) / std::max(pixels_per_uv, 1e-6f)) + bias;
+		int level = lod <= 0.0f ? 0 : std::min((int)lod, entry->tail);
+		entry->wanted = entry->last_used == frame ? std::min(entry->wanted, level) : level;
+		entry->last_used = frame;
+	}
+
+	// Uploads requested levels as the per-frame and memory budgets allow.
+	void Update() {
+		size_t uploaded = 0;
+		for (Entry& entry : entries) {
+			while (entry.last_used == frame && entry.base > entry.wanted && uploaded < MaxUploadBytesPerFrame) {
+				size_t size = LevelBytes(entry, entry.base - 1);
+				if (!MakeRoom(size)) {
+					break;
+				}
+				UploadLevel(entry, entry.base - 1);
+				uploaded += size;
+			}
+		}
+		++frame;
+	}
+
+	// A summary line, then one per texture: the finest resident level, its
+	// memory and how long the first upload took.
+	void Report(std::ostream& out) const {
+		out << "textures: " << resident / 1024 << " KB of " << budget / 1024 << " KB budget, "
+			<< level_uploads << " level uploads, " << evictions << " evictions so far\n";
+		for (const Entry& entry : entries) {
+			const DdsFile::Level& level = entry.layers[0]->levels[entry.base];
+			out << "  " << entry.name << ": " << entry.layers[0]->FormatName();
+			if (entry.target == GL_TEXTURE_2D_ARRAY) {
+				out << " array of " << entry.layers.size();
+			}
+			out << ", level " << entry.base << " (" << level.width << "x" << level.height
+				<< ") and down resident, " << entry.bytes / 1024 << " KB, loaded in " << entry.load_ms << " ms\n";
+		}
+	}
+
+	size_t ResidentBytes() const { return resident; }
+
+private:
+	struct Entry {
+		std::string name;
+		GLuint texture;
+		GLenum target; // GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY of layers
+		bool owned;
+		std::vector<std::shared_ptr<DdsFile> > layers;
+		double load_ms;
+		int tail;    // first level of the mip tail
+		int base;    // finest resident level
+		int wanted;  // finest level requested this frame
+		unsigned long last_used;
+		size_t bytes;
+	};
+
+	// Uploads the mip tail and adds the entry.
+	void Insert(Entry& entry, double load_ms) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const DdsFile& dds = *entry.layers[0];
+		entry.tail = 0;
+		while (entry.tail + 1 < dds.level_count && std::max(dds.levels[entry.tail].width, dds.levels[entry.tail].height) > TailSize) {
+			++entry.tail;
+		}
+		entry.base = dds.level_count;
+		entry.wanted = entry.tail;
+		entry.last_used = 0;
+		entry.bytes = 0;
+
+		GLState().BindTexture(entry.target, entry.texture);
+		glTexParameteri(entry.target, GL_TEXTURE_MAX_LEVEL, dds.level_count - 1);
+		while (entry.base > entry.tail) {
+			UploadLevel(entry, entry.base - 1);
+		}
+		entry.load_ms = load_ms + std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		entries.push_back(entry);
+	}
+
+	static size_t LevelBytes(const Entry& entry, int index) {
+		return entry.layers[0]->levels[index].size * entry.layers.size();
+	}
+
+	Entry* Find(GLuint texture) {
+		// A handful of textures.
+		for (Entry& entry : entries) {
+			if (entry.texture == texture) {
+				return &entry;
+			}
+		}
+		return NULL;
+	}
+
+	void UploadLevel(Entry& entry, int index) {
+		const DdsFile& dds = *entry.layers[0];
+		const DdsFile::Level& level = dds.levels[index];
+		GLState().BindTexture(entry.target, entry.texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		if (entry.target == GL_TEXTURE_2D_ARRAY) {
+			// Allocate the level for every layer, then copy each in from its mapping.
+			GLsizei layers = (GLsizei)entry.layers.size();
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, index, dds.format, level.width, level.height, layers, 0, (GLsizei)level.size * layers, NULL);
+			for (GLsizei layer = 0; layer < layers; ++layer) {
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, index, 0, 0, layer, level.width, level.height, 1, dds.format, (GLsizei)level.size,
+					entry.layers[layer]->file.Data() + entry.layers[layer]->levels[index].offset);
+			}
+		}
+		else {
+			glCompressedTexImage2D(GL_TEXTURE_2D, index, dds.format, level.width, level.height, 0, (GLsizei)level.size,
+				dds.file.Data() + level.offset);
+		}
+		glTexParameteri(entry.target, GL_TEXTURE_BASE_LEVEL, index);
+		entry.base = index;
+		entry.bytes += LevelBytes(entry, index);
+		resident += LevelBytes(entry, index);
+		++level_uploads;
+	}
+
+	void EvictLevel(Entry& entry) {
+		GLenum format = entry.layers[0]->format;
+		GLState().BindTexture(entry.target, entry.texture);
+		glTexParameteri(entry.target, GL_TEXTURE_BASE_LEVEL, entry.base + 1);
+		if (entry.target == GL_TEXTURE_2D_ARRAY) {
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, entry.base, format, 0, 0, 0, 0, 0, NULL);
+		}
+		else {
+			glCompressedTexImage2D(GL_TEXTURE_2D, entry.base, format, 0, 0, 0, 0, NULL);
+		}
+		entry.bytes -= LevelBytes(entry, entry.base);
+		resident -= LevelBytes(entry, entry.base);
+		entry.base += 1;
+		++evictions;
+	}
+
+	// Evicts until bytes more fit the budget; false if they can't.
+	bool MakeRoom(size_t bytes) {
+		while (resident + bytes > budget) {
+			// Least recently requested first; this frame's textures only give up levels they don't need.
+			Entry* victim = NULL;
+			for (Entry& entry : entries) {
+				int keep = entry.last_used == frame ? entry.wanted : entry.tail;
+				if (entry.base < keep && (victim == NULL || entry.last_used < victim->last_used)) {
+					victim = &entry;
+				}
+			}
+			if (victim == NULL) {
+				return false;
+			}
+			EvictLevel(*victim);
+		}
+		return true;
+	}
+
+	size_t budget;
+	size_t resident;
+	unsigned long frame;
+	std::vector<Entry> entries;
+	unsigned long level_uploads;
+	unsigned long evictions;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef TRANSFORM_BENCHMARK_HPP
+#define TRANSFORM_BENCHMARK_HPP
+
+#include <math.h>
+#include <vector>
+#include <random>
+#include <iostream>
+#include <functional>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../shared/gl_state_cache.hpp"
+#include "renderable.hpp"
+#include "entities.hpp"
+#include "resident_column.hpp"
+
+// hw2 --benchmark-transforms: draws 10k and 100k randomly rotated cubes, all
+// in view, with the per-vertex quaternion rotation of ObjectQuaternion.vertexshader
+// (position and quat attributes) and with the per-instance matrices
+// Object.vertexshader fetches from transform_unit (an index attribute), and
+// prints the time per frame of each:
+//     vertex   with GL_RASTERIZER_DISCARD, so only the vertex stage runs
+//     draw     the whole draw, rasterization included
+// The instances sit in static buffers, uploaded once; the time to turn the
+// quats into matrices on the CPU is printed next to them. Every frame ends
+// with glFinish, so the times include the GPU work.
+inline void BenchmarkTransforms(const GLfloat* cube_vertices, GLsizei cube_vertex_count, GLuint matrix_program, GLint transform_unit,
+	GLuint quaternion_program) {
+	const int Sizes[] = { 10000, 100000 };
+	const int MaxInstances = 100000;
+
+	glm::mat4 view_projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 200.0f)
+		* glm::lookAt(glm::vec3(0.0f, 60.0f, -60.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	GLint matrix_mvp = glGetUniformLocation(matrix_program, "MVP");
+	GLint quaternion_mvp = glGetUniformLocation(quaternion_program, "MVP");
+
+	GLuint buffers[3];
+	glGenBuffers(3, buffers);
+	GLuint position_buffer = buffers[0], quat_buffer = buffers[1], index_buffer = buffers[2];
+	ResidentColumn resident_transforms;
+	resident_transforms.Create(MaxInstances, sizeof(PackedTransform), GL_RGBA32F);
+	GLState().BindTextureUnit(transform_unit, GL_TEXTURE_BUFFER, resident_transforms.Texture());
+
+	Renderable quat_mesh;
+	quat_mesh.Create(cube_vertices, cube_vertex_count, 6 * sizeof(GLfloat));
+	quat_mesh.VertexAttrib(0, 3, 0);
+	quat_mesh.InstanceAttrib(1, 3, position_buffer);
+	quat_mesh.VertexAttrib(2, 3, 3 * sizeof(GLfloat));
+	quat_mesh.InstanceAttrib(3, 4, quat_buffer);
+
+	Renderable matrix_mesh;
+	matrix_mesh.CreateShared(quat_mesh);
+	matrix_mesh.VertexAttrib(0, 3, 0);
+	matrix_mesh.InstanceAttribI(1, 1, index_buffer);
+	matrix_mesh.VertexAttrib(2, 3, 3 * sizeof(GLfloat));
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> xz(-40.0f, 40.0f);
+	std::normal_distribution<float> gauss(0.0f, 1.0f);
+	std::vector<glm::vec3> positions(MaxInstances);
+	std::vector<glm::vec4> quats(MaxInstances);
+	std::vector<PackedTransform> transforms(MaxInstances);
+	std::vector<uint32_t> indices(MaxInstances);
+	for (int i = 0; i < MaxInstances; ++i) {
+		positions[i] = glm::vec3(xz(rng), 0.0f, xz(rng));
+		glm::vec4 q(gauss(rng), gauss(rng), gauss(rng), gauss(rng));
+		quats[i] = q / sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+		indices[i] = (uint32_t)i;
+	}
+
+	double convert_start = glfwGetTime();
+	for (int i = 0; i < MaxInstances; ++i) {
+		transforms[i] = PackTransform(positions[i], quats[i]);
+	}
+	double convert_ms = (glfwGetTime() - convert_start) * 1000.0;
+
+	GLState().BindBuffer(GL_ARRAY_BUFFER, position_buffer);
+	glBufferData(GL_ARRAY_BUFFER, MaxInstances * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+	GLState().BindBuffer(GL_ARRAY_BUFFER, quat_buffer);
+	glBufferData(GL_ARRAY_BUFFER, MaxInstances * sizeof(glm::vec4), quats.data(), GL_STATIC_DRAW);
+	GLState().BindBuffer(GL_ARRAY_BUFFER, index_buffer);
+	glBufferData(GL_ARRAY_BUFFER, MaxInstances * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+	DirtyRanges everything;
+	everything.Mark(0, MaxInstances);
+	resident_transforms.Patch(transforms.data(), MaxInstances, everything);
+
+	std::cout << "transform benchmark: " << MaxInstances << " quats to matrices on the CPU in " << convert_ms << " ms, "
+		<< sizeof(glm::vec3) + sizeof(glm::vec4) << " bytes per instance as position and quat, " << sizeof(PackedTransform) << " as a matrix\n";
+
+	for (int size : Sizes) {
+		std::function<void()> paths[2] = {
+			[&]() {
+				GLState().UseProgram(quaternion_program);
+				glUniformMatrix4fv(quaternion_mvp, 1, GL_FALSE, &view_projection[0][0]);
+				GLintptr offsets[] = { 0, 0 };
+				quat_mesh.DrawInstanced(size, offsets);
+			},
+			[&]() {
+				GLState().UseProgram(matrix_program);
+				glUniformMatrix4fv(matrix_mvp, 1, GL_FALSE, &view_projection[0][0]);
+				GLintptr offsets[] = { 0 };
+				matrix_mesh.DrawInstanced(size, offsets);
+			},
+		};
+
+		// [discard][path]
+		double ms[2][2];
+		for (int discard = 0; discard < 2; ++discard) {
+			for (int p = 0; p < 2; ++p) {
+				// At least three frames and a quarter of a second per path, after one warm-up frame.
+				if (discard == 0) {
+					glEnable(GL_RASTERIZER_DISCARD);
+				}
+				paths[p]();
+				glFinish();
+				int frames = 0;
+				double start = glfwGetTime();
+				double elapsed = 0.0;
+				do {
+					glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+					paths[p]();
+					glFinish();
+					++frames;
+					elapsed = glfwGetTime() - start;
+				} while (frames < 3 || elapsed < 0.25);
+				glDisable(GL_RASTERIZER_DISCARD);
+				ms[discard][p] = elapsed * 1000.0 / frames;
+			}
+		}
+
+		std::cout << size << " instances: vertex quat " << ms[0][0] << " ms, matrix " << ms[0][1]
+			<< " ms; draw quat " << ms[1][0] << " ms, matrix " << ms[1][1] << " ms\n";
+	}
+
+	matrix_mesh.Destroy();
+	quat_mesh.Destroy();
+	resident_transforms.Destroy();
+	GLState().DeleteBuffers(3, buffers);
+}
+
+#endif
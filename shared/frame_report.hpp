@@ -0,0 +1,176 @@
+#ifndef FRAME_REPORT_HPP
+#define FRAME_REPORT_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+
+#include <GL/glew.h>
+
+// Per-frame CPU time, GPU time, draw calls, triangles and GL state changes
+// (made and skipped, see gl_state_cache.hpp), written out at the end of a run
+// as CSV (a path ending in .csv) or JSON.
+//
+// CPU time is the wall time from BeginFrame to EndFrame. GPU time and
+// triangles come from GL_TIME_ELAPSED and GL_PRIMITIVES_GENERATED queries
+// that are read back QueriesInFlight frames late, so the CPU never waits on
+// them. Primitives generated counts everything the frame draws, text
+// included, and the points of transform feedback passes.
+class FrameReport {
+public:
+	static const int QueriesInFlight = 4;
+
+	struct Frame {
+		int frame;
+		double cpu_ms;
+		double gpu_ms;
+		unsigned long draw_calls;
+		unsigned long long triangles;
+		unsigned long state_changes;
+		unsigned long state_skipped;
+	};
+
+	FrameReport() : created(false), in_frame(false), collected(0), draws_at_begin(0), state_at_begin(0), skipped_at_begin(0) {}
+
+	void Create() {
+		glGenQueries(QueriesInFlight, time_queries);
+		glGenQueries(QueriesInFlight, primitive_queries);
+		// llvmpipe times the first query around any rendering from zero
+		// instead of from its start; spend that one on a clear.
+		glBeginQuery(GL_TIME_ELAPSED, time_queries[0]);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 ignored;
+		glGetQueryObjectui64v(time_queries[0], GL_QUERY_RESULT, &ignored);
+		created = true;
+	}
+
+	void Destroy() {
+		if (created) {
+			glDeleteQueries(QueriesInFlight, time_queries);
+			glDeleteQueries(QueriesInFlight, primitive_queries);
+			created = false;
+		}
+	}
+
+	// Running totals: draw_calls of draw calls, e.g. GLDrawCallCount(), and
+	// state_changes and state_skipped e.g. GLState().Issued() and Skipped().
+	void BeginFrame(unsigned long draw_calls, unsigned long state_changes, unsigned long state_skipped) {
+		int index = (int)frames.size();
+		if (index >= QueriesInFlight) {
+			Collect(index - QueriesInFlight);
+		}
+		int slot = index % QueriesInFlight;
+		glBeginQuery(GL_TIME_ELAPSED, time_queries[slot]);
+		glBeginQuery(GL_PRIMITIVES_GENERATED, primitive_queries[slot]);
+		Frame frame = { index, 0.0, 0.0, 0, 0, 0, 0 };
+		frames.push_back(frame);
+		draws_at_begin = draw_calls;
+		state_at_begin = state_changes;
+		skipped_at_begin = state_skipped;
+		cpu_start = Clock::now();
+		in_frame = true;
+	}
+
+	void EndFrame(unsigned long draw_calls, unsigned long state_changes, unsigned long state_skipped) {
+		if (!in_frame) {
+			return;
+		}
+		glEndQuery(GL_PRIMITIVES_GENERATED);
+		glEndQuery(GL_TIME_ELAPSED);
+		Frame& frame = frames.back();
+		frame.cpu_ms = std::chrono::duration<double, std::milli>(Clock::now() - cpu_start).count();
+		frame.draw_calls = draw_calls - draws_at_begin;
+		frame.state_changes = state_changes - state_at_begin;
+		frame.state_skipped = state_skipped - skipped_at_begin;
+		in_frame = false;
+	}
+
+	// Reads back the outstanding queries and writes every frame to path.
+	bool Write(const char* path) {
+		CollectAll();
+		FILE* file = fopen(path, "w");
+		if (file == NULL) {
+			fprintf(stderr, "Impossible to write the frame report %s\n", path);
+			return false;
+		}
+		size_t length = strlen(path);
+		bool csv = length >= 4 && strcmp(path + length - 4, ".csv") == 0;
+		if (csv) {
+			fprintf(file, "frame,cpu_ms,gpu_ms,draw_calls,triangles,state_changes,state_skipped\n");
+			for (const Frame& f : frames) {
+				fprintf(file, "%d,%.4f,%.4f,%lu,%llu,%lu,%lu\n", f.frame, f.cpu_ms, f.gpu_ms, f.draw_calls, f.triangles,
+					f.state_changes, f.state_skipped);
+			}
+		}
+		else {
+			fprintf(file, "{\n\t\"frames\": [\n");
+			for (size_t i = 0; i < frames.size(); ++i) {
+				const Frame& f = frames[i];
+				fprintf(file, "\t\t{ \"frame\": %d, \"cpu_ms\": %.4f, \"gpu_ms\": %.4f, \"draw_calls\": %lu, \"triangles\": %llu, "
+					"\"state_changes\": %lu, \"state_skipped\": %lu }%s\n",
+					f.frame, f.cpu_ms, f.gpu_ms, f.draw_calls, f.triangles, f.state_changes, f.state_skipped, i + 1 < frames.size() ? "," : "");
+			}
+			fprintf(file, "\t]\n}\n");
+		}
+		fclose(file);
+		return true;
+	}
+
+	// Means over every frame so far; the last QueriesInFlight GPU times are
+	// only in once CollectAll (or Write) has run.
+	void Summary(double* cpu_ms, double* gpu_ms, double* state_changes, double* state_skipped) const {
+		*cpu_ms = *gpu_ms = *state_changes = *state_skipped = 0.0;
+		for (const Frame& f : frames) {
+			*cpu_ms += f.cpu_ms;
+			*gpu_ms += f.gpu_ms;
+			*state_changes += f.state_changes;
+			*state_skipped += f.state_skipped;
+		}
+		if (!frames.empty()) {
+			*cpu_ms /= frames.size();
+			*gpu_ms /= frames.size();
+			*state_changes /= frames.size();
+			*state_skipped /= frames.size();
+		}
+	}
+
+	void CollectAll() {
+		if (in_frame) {
+			EndFrame(draws_at_begin, state_at_begin, skipped_at_begin);
+		}
+		while (collected < frames.size()) {
+			Collect((int)collected);
+		}
+	}
+
+	size_t FrameCount() const { return frames.size(); }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void Collect(int index) {
+		int slot = index % QueriesInFlight;
+		GLuint64 elapsed_ns = 0;
+		GLuint64 primitives = 0;
+		glGetQueryObjectui64v(time_queries[slot], GL_QUERY_RESULT, &elapsed_ns);
+		glGetQueryObjectui64v(primitive_queries[slot], GL_QUERY_RESULT, &primitives);
+		frames[index].gpu_ms = elapsed_ns / 1e6;
+		frames[index].triangles = primitives;
+		collected = index + 1;
+	}
+
+	GLuint time_queries[QueriesInFlight];
+	GLuint primitive_queries[QueriesInFlight];
+	bool created;
+	bool in_frame;
+	std::vector<Frame> frames;
+	size_t collected;
+	unsigned long draws_at_begin;
+	unsigned long state_at_begin;
+	unsigned long skipped_at_begin;
+	Clock::time_point cpu_start;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef GL_CALL_COUNTER_HPP
+#define GL_CALL_COUNTER_HPP
+
+// Include this instead of GL/glew.h, before anything else pulls GLEW in.
+//
+// Draw calls made from the including file are always counted, for the frame
+// reports (see frame_report.hpp). Build with -DCOUNT_GL_CALLS to count every
+// GL call as well: GLEW dispatches every entry point past GL 1.1 through
+// GLEW_GET_FUN, so hooking that macro counts them without touching the call
+// sites; the 1.1 functions are called directly and get wrapper macros of
+// their own.
+
+inline unsigned long& GLDrawCallCount() {
+	static unsigned long count = 0;
+	return count;
+}
+
+#ifdef COUNT_GL_CALLS
+
+inline unsigned long& GLCallCount() {
+	static unsigned long count = 0;
+	return count;
+}
+
+#define GLEW_GET_FUN(x) (++GLCallCount(), x)
+#include <GL/glew.h>
+
+#define GL_COUNTED_CALL(function, ...) (++GLCallCount(), function(__VA_ARGS__))
+#define glBindTexture(...) GL_COUNTED_CALL(glBindTexture, __VA_ARGS__)
+#define glBlendFunc(...) GL_COUNTED_CALL(glBlendFunc, __VA_ARGS__)
+#define glClear(...) GL_COUNTED_CALL(glClear, __VA_ARGS__)
+#define glClearColor(...) GL_COUNTED_CALL(glClearColor, __VA_ARGS__)
+#define glCullFace(...) GL_COUNTED_CALL(glCullFace, __VA_ARGS__)
+#define glDepthFunc(...) GL_COUNTED_CALL(glDepthFunc, __VA_ARGS__)
+#define glDepthMask(...) GL_COUNTED_CALL(glDepthMask, __VA_ARGS__)
+#define glDisable(...) GL_COUNTED_CALL(glDisable, __VA_ARGS__)
+#define glEnable(...) GL_COUNTED_CALL(glEnable, __VA_ARGS__)
+#define glGetIntegerv(...) GL_COUNTED_CALL(glGetIntegerv, __VA_ARGS__)
+#define glViewport(...) GL_COUNTED_CALL(glViewport, __VA_ARGS__)
+#define GL_COUNTED_DRAW_1_1() ++GLCallCount()
+
+#else
+
+#include <GL/glew.h>
+#define GL_COUNTED_DRAW_1_1() (void)0
+
+#endif
+
+#define GL_COUNTED_DRAW(function, ...) (++GLDrawCallCount(), function(__VA_ARGS__))
+#define glDrawArrays(...) (GL_COUNTED_DRAW_1_1(), GL_COUNTED_DRAW(glDrawArrays, __VA_ARGS__))
+#define glDrawElements(...) (GL_COUNTED_DRAW_1_1(), GL_COUNTED_DRAW(glDrawElements, __VA_ARGS__))
+
+// GLEW's own macros for these expand to GLEW_GET_FUN(__glewName), which still
+// goes through the GL call count above.
+#undef glDrawArraysInstanced
+#undef glDrawElementsInstanced
+#undef glDrawArraysIndirect
+#undef glDrawElementsIndirect
+#define glDrawArraysInstanced(...) GL_COUNTED_DRAW(GLEW_GET_FUN(__glewDrawArraysInstanced), __VA_ARGS__)
+#define glDrawElementsInstanced(...) GL_COUNTED_DRAW(GLEW_GET_FUN(__glewDrawElementsInstanced), __VA_ARGS__)
+#define glDrawArraysIndirect(...) GL_COUNTED_DRAW(GLEW_GET_FUN(__glewDrawArraysIndirect), __VA_ARGS__)
+#define glDrawElementsIndirect(...) GL_COUNTED_DRAW(GLEW_GET_FUN(__glewDrawElementsIndirect), __VA_ARGS__)
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef GL_STATE_CACHE_HPP
+#define GL_STATE_CACHE_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <GL/glew.h>
+
+// The bindings GL last got from this program, so setting one that is already
+// current costs no call. Every glUseProgram, glBindVertexArray, glBindBuffer,
+// glActiveTexture, glBindTexture and glUniform1i of a program goes through
+// GLState() instead, as do deletes of what they bind (GL unbinds a deleted
+// object, and its name may come back).
+//
+// Calls made elsewhere (a library, a loader) leave the cache stale; call
+// Invalidate() after them and every binding is issued again once.
+//
+// GL_ELEMENT_ARRAY_BUFFER is part of the bound vertex array, so those binds
+// are always issued.
+class GLStateCache {
+public:
+	static const int MaxTextureUnits = 32;
+
+	GLStateCache() : issued(0), skipped(0) { Invalidate(); }
+
+	void Invalidate() {
+		program = Unknown;
+		vertex_array = Unknown;
+		active_unit = Unknown;
+		for (int t = 0; t < BufferTargetCount; ++t) {
+			buffers[t] = Unknown;
+		}
+		for (int u = 0; u < MaxTextureUnits; ++u) {
+			for (int t = 0; t < TextureTargetCount; ++t) {
+				textures[u][t] = Unknown;
+			}
+		}
+		uniforms.clear();
+	}
+
+	void UseProgram(GLuint _program) {
+		if (Skip(program == _program)) {
+			return;
+		}
+		glUseProgram(_program);
+		program = _program;
+	}
+
+	void BindVertexArray(GLuint array) {
+		if (Skip(vertex_array == array)) {
+			return;
+		}
+		glBindVertexArray(array);
+		vertex_array = array;
+	}
+
+	void BindBuffer(GLenum target, GLuint buffer) {
+		int t = BufferTarget(target);
+		if (Skip(t >= 0 && buffers[t] == buffer)) {
+			return;
+		}
+		glBindBuffer(target, buffer);
+		if (t >= 0) {
+			buffers[t] = buffer;
+		}
+	}
+
+	// Also binds buffer to target itself, like glBindBufferBase.
+	void BindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+		++issued;
+		glBindBufferBase(target, index, buffer);
+		int t = BufferTarget(target);
+		if (t >= 0) {
+			buffers[t] = buffer;
+		}
+	}
+
+	// unit is GL_TEXTURE0 + i, as for glActiveTexture.
+	void ActiveTexture(GLenum unit) {
+		if (Skip(active_unit == unit)) {
+			return;
+		}
+		glActiveTexture(unit);
+		active_unit = unit;
+	}
+
+	// On the active unit.
+	void BindTexture(GLenum target, GLuint texture) {
+		GLuint* bound = TextureBinding(active_unit, target);
+		if (Skip(bound != NULL && *bound == texture)) {
+			return;
+		}
+		glBindTexture(target, texture);
+		if (bound != NULL) {
+			*bound = texture;
+		}
+	}
+
+	// Binds texture on unit (GL_TEXTURE0 + unit) and leaves the active unit as
+	// it was, switching units only if the binding changes.
+	void BindTextureUnit(GLuint unit, GLenum target, GLuint texture) {
+		GLuint* bound = TextureBinding(GL_TEXTURE0 + unit, target);
+		if (bound != NULL && *bound == texture) {
+			++skipped;
+			return;
+		}
+		if (active_unit == Unknown) {
+			GLint active = GL_TEXTURE0;
+			glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+			active_unit = (GLenum)active;
+		}
+		GLenum previous = active_unit;
+		ActiveTexture(GL_TEXTURE0 + unit);
+		BindTexture(target, texture);
+		ActiveTexture(previous);
+	}
+
+	// On the current program; values are remembered per program and location.
+	void Uniform1i(GLint location, GLint value) {
+		// GL ignores location -1 (a uniform the program doesn't use).
+		if (Skip(location < 0)) {
+			return;
+		}
+		if (program == Unknown) {
+			glUniform1i(location, value);
+			return;
+		}
+		uint64_t key = (uint64_t)program << 32 | (uint32_t)location;
+		std::unordered_map<uint64_t, GLint>::iterator found = uniforms.find(key);
+		if (Skip(found != uniforms.end() && found->second == value)) {
+			return;
+		}
+		glUniform1i(location, value);
+		uniforms[key] = value;
+	}
+
+	void DeleteProgram(GLuint _program) {
+		glDeleteProgram(_program);
+		if (program == _program) {
+			program = Unknown;
+		}
+		for (std::unordered_map<uint64_t, GLint>::iterator it = uniforms.begin(); it != uniforms.end();) {
+			it = (GLuint)(it->first >> 32) == _program ? uniforms.erase(it) : ++it;
+		}
+	}
+
+	void DeleteVertexArrays(GLsizei n, const GLuint* arrays) {
+		glDeleteVertexArrays(n, arrays);
+		Forget(arrays, n, &vertex_array, 1);
+	}
+
+	void DeleteBuffers(GLsizei n, const GLuint* names) {
+		glDeleteBuffers(n, names);
+		Forget(names, n, buffers, BufferTargetCount);
+	}
+
+	void DeleteTextures(GLsizei n, const GLuint* names) {
+		glDeleteTextures(n, names);
+		Forget(names, n, &textures[0][0], MaxTextureUnits * TextureTargetCount);
+	}
+
+	// State changes made, and dropped as redundant, so far.
+	unsigned long Issued() const { return issued; }
+	unsigned long Skipped() const { return skipped; }
+
+private:
+	static const GLuint Unknown = 0xffffffffu;
+	static const int BufferTargetCount = 8;
+	static const int TextureTargetCount = 5;
+
+	bool Skip(bool redundant) {
+		++(redundant ? skipped : issued);
+		return redundant;
+	}
+
+	// -1 for targets not cached.
+	static int BufferTarget(GLenum target) {
+		switch (target) {
+		case GL_ARRAY_BUFFER: return 0;
+		case GL_DRAW_INDIRECT_BUFFER: return 1;
+		case GL_TRANSFORM_FEEDBACK_BUFFER: return 2;
+		case GL_QUERY_BUFFER: return 3;
+		case GL_UNIFORM_BUFFER: return 4;
+		case GL_COPY_READ_BUFFER: return 5;
+		case GL_COPY_WRITE_BUFFER: return 6;
+		case GL_PIXEL_UNPACK_BUFFER: return 7;
+		default: return -1;
+		}
+	}
+
+	GLuint* TextureBinding(GLenum unit, GLenum target) {
+		int t = -1;
+		switch (target) {
+		case GL_TEXTURE_2D: t = 0; break;
+		case GL_TEXTURE_2D_ARRAY: t = 1; break;
+		case GL_TEXTURE_BUFFER: t = 2; break;
+		case GL_TEXTURE_CUBE_MAP: t = 3; break;
+		case GL_TEXTURE_3D: t = 4; break;
+		}
+		GLuint u = unit - GL_TEXTURE0;
+		return t >= 0 && unit != Unknown && u < (GLuint)MaxTextureUnits ? &textures[u][t] : NULL;
+	}
+
+	// Bindings to a deleted name fall back to 0, as GL's do.
+	static void Forget(const GLuint* names, GLsizei n, GLuint* bindings, int count) {
+		for (GLsizei i = 0; i < n; ++i) {
+			if (names[i] != 0) {
+				std::replace(bindings, bindings + count, names[i], 0u);
+			}
+		}
+	}
+
+	GLuint program;
+	GLuint vertex_array;
+	GLenum active_unit;
+	GLuint buffers[BufferTargetCount];
+	GLuint textures[MaxTextureUnits][TextureTargetCount];
+	std::unordered_map<uint64_t, GLint> uniforms; // program << 32 | location
+	unsigned long issued;
+	unsigned long skipped;
+};
+
+// The one context's cache.
+inline GLStateCache& GLState() {
+	static GLStateCache cache;
+	return cache;
+}
+
+// Draws collected for a pass and made in an order that keeps state changes
+// down: sorted by layer (what has to draw before what), then program, then
+// texture. The sort is stable, so draws with the same key keep their order.
+//
+//     queue.Add(0, program, texture, [&]() { ... });  ...  queue.Submit();
+class DrawQueue {
+public:
+	typedef std::function<void()> Draw;
+
+	void Add(unsigned layer, GLuint program, GLuint texture, Draw draw) {
+		Entry entry = { (uint64_t)layer << 56 | (uint64_t)(program & 0xffffff) << 32 | texture, draw };
+		entries.push_back(entry);
+	}
+
+	// Makes the draws and empties the queue.
+	void Submit() {
+		std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.key < b.key; });
+		for (const Entry& entry : entries) {
+			entry.draw();
+		}
+		entries.clear();
+	}
+
+private:
+	struct Entry {
+		uint64_t key;
+		Draw draw;
+	};
+
+	std::vector<Entry> entries;
+};
+
+#endif
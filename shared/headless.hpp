@@ -0,0 +1,262 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+// Runs without a display or a GPU, for benchmarks and regression tests on
+// CI machines:
+//     --headless <frames>   render that many frames offscreen and exit
+//     --input <script>      mouse buttons from a script (input_script.hpp)
+//     --report <file>       per-frame timings as .csv or .json (frame_report.hpp)
+//
+// The window comes from GLFW's null platform (GLFW 3.4), so window, cursor
+// and key calls keep working and report nothing pressed. The GL 3.3 core
+// context is created with EGL on a pbuffer, on Mesa's surfaceless platform
+// when it is there (llvmpipe needs nothing else). Link with -lEGL. Windows
+// builds have no EGL and only the --input and --report options.
+//
+// Time advances by exactly FramePeriod per frame, so a run with the same
+// input script always sees the same frame times.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#define HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "gl_call_counter.hpp"
+#include "gl_state_cache.hpp"
+#include <GLFW/glfw3.h>
+
+#include "input_script.hpp"
+#include "frame_report.hpp"
+
+class Headless {
+public:
+	static constexpr double FramePeriod = 1.0 / 60.0;
+
+	Headless() : frames(-1), frame(0), input_path(NULL), report_path(NULL), window(NULL)
+#ifdef HEADLESS_EGL
+		, display(EGL_NO_DISPLAY), surface(EGL_NO_SURFACE), context(EGL_NO_CONTEXT)
+#endif
+	{}
+
+	// Consumes argv[i] (and its value, advancing i) if it is one of the
+	// options above.
+	bool ParseArg(int argc, char* argv[], int& i) {
+		if (i + 1 >= argc) {
+			return false;
+		}
+		if (strcmp(argv[i], "--headless") == 0) {
+			frames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--input") == 0) {
+			input_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--report") == 0) {
+			report_path = argv[++i];
+		}
+		else {
+			return false;
+		}
+		return true;
+	}
+
+	bool Enabled() const { return frames >= 0; }
+	bool Reporting() const { return Enabled() || report_path != NULL; }
+
+	// Stands in for glfwInit.
+	bool Init() {
+		if (input_path != NULL && !input.Load(input_path)) {
+			return false;
+		}
+		if (Enabled()) {
+#if defined(GLFW_PLATFORM_NULL) && defined(HEADLESS_EGL)
+			glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+			fprintf(stderr, "Headless runs need EGL and GLFW 3.4 or later\n");
+			return false;
+#endif
+		}
+		return glfwInit() == GLFW_TRUE;
+	}
+
+	// Stands in for glfwCreateWindow and glfwMakeContextCurrent; the GLFW
+	// context hints set before still apply to windowed runs.
+	GLFWwindow* OpenWindow(int width, int height, const char* title) {
+		if (!Enabled()) {
+			window = glfwCreateWindow(width, height, title, NULL, NULL);
+			if (window != NULL) {
+				glfwMakeContextCurrent(window);
+			}
+			return window;
+		}
+#if defined(GLFW_PLATFORM_NULL) && defined(HEADLESS_EGL)
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		window = glfwCreateWindow(width, height, title, NULL, NULL);
+		if (window == NULL || !CreateContext(width, height)) {
+			return NULL;
+		}
+		// Where the controls put the cursor back every frame, so it never moves.
+		glfwSetCursorPos(window, width / 2, height / 2);
+#endif
+		return window;
+	}
+
+	// Stands in for glewInit. A GLX build of GLEW has no X display to query
+	// here, which is not an error for the GL functions.
+	bool InitGlew() {
+		glewExperimental = true; // Needed for core profile
+		GLenum status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+		if (Enabled() && status == GLEW_ERROR_NO_GLX_DISPLAY) {
+			status = GLEW_OK;
+		}
+#endif
+		if (status != GLEW_OK) {
+			return false;
+		}
+		if (Reporting()) {
+			report.Create();
+		}
+		return true;
+	}
+
+	// Stands in for glfwGetTime.
+	double Time() const {
+		return Enabled() ? frame * FramePeriod : glfwGetTime();
+	}
+
+	// Stands in for glfwGetMouseButton.
+	int MouseButton(int button) const {
+		if (input_path != NULL) {
+			return input.MouseButton(button);
+		}
+		return glfwGetMouseButton(window, button);
+	}
+
+	// Call at the top of the render loop.
+	void BeginFrame() {
+		input.Advance(frame);
+		if (Reporting()) {
+			report.BeginFrame(GLDrawCallCount(), GLState().Issued(), GLState().Skipped());
+		}
+	}
+
+	// Stands in for glfwSwapBuffers.
+	void SwapBuffers() {
+		if (Reporting()) {
+			report.EndFrame(GLDrawCallCount(), GLState().Issued(), GLState().Skipped());
+		}
+#ifdef HEADLESS_EGL
+		if (Enabled()) {
+			eglSwapBuffers(display, surface);
+		}
+		else
+#endif
+		{
+			glfwSwapBuffers(window);
+		}
+		++frame;
+	}
+
+	// Stands in for glfwWindowShouldClose.
+	bool ShouldClose() const {
+		return Enabled() ? frame >= frames : glfwWindowShouldClose(window) != 0;
+	}
+
+	int Frame() const { return frame; }
+
+	// Stands in for glfwTerminate at the end of main: writes the report and
+	// tears down the context.
+	void Terminate() {
+		if (Reporting()) {
+			report.CollectAll();
+			double cpu_ms, gpu_ms, state_changes, state_skipped;
+			report.Summary(&cpu_ms, &gpu_ms, &state_changes, &state_skipped);
+			printf("%d frames: %.3f ms cpu, %.3f ms gpu, %.1f state changes (%.1f skipped) per frame\n", (int)report.FrameCount(),
+				cpu_ms, gpu_ms, state_changes, state_skipped);
+			if (report_path != NULL) {
+				report.Write(report_path);
+			}
+			report.Destroy();
+		}
+#ifdef HEADLESS_EGL
+		if (context != EGL_NO_CONTEXT) {
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(display, context);
+			eglDestroySurface(display, surface);
+			eglTerminate(display);
+			context = EGL_NO_CONTEXT;
+		}
+#endif
+		glfwTerminate();
+	}
+
+private:
+#ifdef HEADLESS_EGL
+	bool CreateContext(int width, int height) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+		if (getPlatformDisplay != NULL) {
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		}
+#endif
+		if (display == EGL_NO_DISPLAY) {
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		}
+		EGLint major, minor;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+			fprintf(stderr, "Failed to initialize EGL\n");
+			return false;
+		}
+
+		const EGLint config_attribs[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+			EGL_DEPTH_SIZE, 24,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint config_count = 0;
+		if (!eglChooseConfig(display, config_attribs, &config, 1, &config_count) || config_count == 0 || !eglBindAPI(EGL_OPENGL_API)) {
+			fprintf(stderr, "No EGL config for desktop OpenGL on a pbuffer\n");
+			return false;
+		}
+
+		const EGLint surface_attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, surface_attribs);
+		const EGLint context_attribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 3,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+		if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)) {
+			fprintf(stderr, "Failed to create a GL 3.3 core context with EGL\n");
+			return false;
+		}
+		return true;
+	}
+#endif
+
+	int frames;
+	int frame;
+	const char* input_path;
+	const char* report_path;
+	GLFWwindow* window;
+	InputScript input;
+	FrameReport report;
+#ifdef HEADLESS_EGL
+	EGLDisplay display;
+	EGLSurface surface;
+	EGLContext context;
+#endif
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef INPUT_SCRIPT_HPP
+#define INPUT_SCRIPT_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <GLFW/glfw3.h>
+
+// Mouse buttons played back from a text file instead of polled from the
+// window, one event per line:
+//     <frame> <left|right|middle> <press|release|click>
+// A click presses on that frame and releases on the next. Lines starting
+// with # are comments. Events take effect at the start of their frame.
+class InputScript {
+public:
+	static const int Buttons = 3; // GLFW_MOUSE_BUTTON_LEFT, _RIGHT, _MIDDLE
+
+	InputScript() : next(0) {
+		for (int b = 0; b < Buttons; ++b) {
+			state[b] = GLFW_RELEASE;
+		}
+	}
+
+	bool Load(const char* path) {
+		FILE* file = fopen(path, "r");
+		if (file == NULL) {
+			fprintf(stderr, "Impossible to open the input script %s\n", path);
+			return false;
+		}
+		char line[256];
+		int line_number = 0;
+		while (fgets(line, sizeof(line), file)) {
+			++line_number;
+			int frame;
+			char button_name[16], action[16];
+			if (line[0] == '#' || sscanf(line, "%d %15s %15s", &frame, button_name, action) != 3) {
+				continue;
+			}
+			int button = strcmp(button_name, "left") == 0 ? GLFW_MOUSE_BUTTON_LEFT
+				: strcmp(button_name, "right") == 0 ? GLFW_MOUSE_BUTTON_RIGHT
+				: strcmp(button_name, "middle") == 0 ? GLFW_MOUSE_BUTTON_MIDDLE : -1;
+			bool click = strcmp(action, "click") == 0;
+			bool press = click || strcmp(action, "press") == 0;
+			if (button < 0 || (!press && strcmp(action, "release") != 0)) {
+				fprintf(stderr, "%s:%d: expected <frame> <left|right|middle> <press|release|click>\n", path, line_number);
+				continue;
+			}
+			events.push_back(Event{ frame, button, press ? GLFW_PRESS : GLFW_RELEASE });
+			if (click) {
+				events.push_back(Event{ frame + 1, button, GLFW_RELEASE });
+			}
+		}
+		fclose(file);
+		std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.frame < b.frame; });
+		return true;
+	}
+
+	// Applies the events up to and including frame; frames must not go backwards.
+	void Advance(int frame) {
+		for (; next < events.size() && events[next].frame <= frame; ++next) {
+			state[events[next].button] = events[next].action;
+		}
+	}
+
+	// GLFW_PRESS or GLFW_RELEASE, like glfwGetMouseButton.
+	int MouseButton(int button) const {
+		return button >= 0 && button < Buttons ? state[button] : GLFW_RELEASE;
+	}
+
+private:
+	struct Event {
+		int frame;
+		int button;
+		int action;
+	};
+
+	std::vector<Event> events;
+	size_t next;
+	int state[Buttons];
+};
+
+#endif